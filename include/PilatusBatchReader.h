@@ -0,0 +1,73 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSBATCHREADER_H
+#define PILATUSBATCHREADER_H
+
+#include <string>
+#include <vector>
+#include "Debug.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class BatchReader
+ * \brief reads whole files by batches into pooled buffers
+ *
+ * Built with WITH_IO_URING, opens, reads and closes of up to
+ * QUEUE_DEPTH files are submitted at once with io_uring
+ * (kernel >= 5.6), so a batch costs a few syscalls instead of
+ * four per file. Otherwise, or if io_uring is not available, files
+ * are read one after the other. A batch is at most QUEUE_DEPTH
+ * files, one buffer each. Buffers are kept for the next batch,
+ * they are valid until then, the ones it doesn't use are freed.
+ *******************************************************************/
+class BatchReader
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"BatchReader","Pilatus");
+public:
+  enum {QUEUE_DEPTH = 32};
+
+  struct File
+  {
+    std::string	path;
+    const char*	data;		///< NULL if the file can't be read
+    long	size;
+  };
+
+  BatchReader();
+  ~BatchReader();
+
+  void read(std::vector<File>& files);
+private:
+  bool _readFile(const std::string& path,std::vector<char>& buffer);
+#ifdef WITH_IO_URING
+  void _readBatch(std::vector<File>& files,size_t first,size_t nb_files);
+#endif
+
+  std::vector<std::vector<char> >	m_buffers;
+  void*					m_ring;	///< io_uring if available
+};
+}
+}
+#endif//PILATUSBATCHREADER_H
@@ -23,6 +23,7 @@
 #define PILATUSCAMERA_H
 
 #include "Debug.h"
+#include "PilatusProtocolLog.h"
 
 
 
@@ -72,6 +73,49 @@ public:
         EXTERNAL_GATE
     };
 
+    enum
+    {
+        DEFAULT_FILE_RING_SIZE = 10000,
+        MIN_FILE_RING_SIZE = 128,
+        MAX_FILE_RING_SIZE = 100000	///< tmp_raw_%.5d.edf
+    };
+
+    struct Parameters
+    {
+        Status status;
+        double energy;			///< keV
+        int threshold;
+        Gain gain;
+        double exposure;
+        double exposure_period;
+        int nb_images_in_sequence;
+        double hardware_trigger_delay;
+        int nb_exposure_per_frame;
+        TriggerMode trigger_mode;
+        bool gapfill;
+        bool continuous;
+        int file_ring_size;
+        int nb_acquired_images;
+        int major_version;
+        int minor_version;
+        int patch_version;
+    };
+
+    struct ReplayStats
+    {
+        ReplayStats() :
+            nb_records(0),nb_sent(0),nb_received(0),nb_bytes(0),
+            nb_mismatches(0),duration(0.),parse_time(0.),max_parse_time(0.) {}
+        long long nb_records;
+        long long nb_sent;
+        long long nb_received;
+        long long nb_bytes;		///< received
+        long long nb_mismatches;	///< status differs from the recorded one
+        double duration;
+        double parse_time;
+        double max_parse_time;		///< longest chunk
+    };
+
     Camera(const char *host = "localhost",int port = 41234);
     ~Camera();
     
@@ -118,6 +162,12 @@ public:
     void stopAcquisition();
     void errorStopAcquisition();
 
+    void setContinuous(bool);
+    bool continuous() const;
+    void setFileRingSize(int nb_files);
+    int fileRingSize() const;
+    int continuousSequenceSize() const;
+
     bool gapfill() const;
     void setGapfill(bool onOff);
     
@@ -128,7 +178,16 @@ public:
 
     int nbAcquiredImages() const;
     void version(int& major,int& minor,int& patch) const;
+    Parameters parameters() const;
+
+    void startRecording(const std::string& path);
+    void stopRecording();
+    bool recording() const;
+    void replay(const std::string& path,bool max_speed,ReplayStats&);
 private:
+    class _Publisher;
+    friend class _Publisher;
+
     static const double             TIME_OUT = 10.;
 
     const        std::string& errorMessage() const;
@@ -139,11 +198,16 @@ private:
     
     static void* _runFunc(void*);
     void         _run();    
+    void         _parse(const std::string& messages);
+    void         _publish();
+    bool         _wait(double timeout);
+    static double _now();
     void         _initVariable();
     void         _resync();
     void         _reinit();
     void	 _pilatus3model(); ///< set pilatus3 threshold extention
     void         _work_around_threshold_bug();
+    void         _startSequence(int image_number);
 
     std::map<std::string,Gain>    GAIN_SERVER_RESPONSE;
     std::map<Gain,std::string>    GAIN_VALUE2SERVER;
@@ -180,6 +244,16 @@ private:
     int			    m_major_version;
     int                     m_minor_version;
     int                     m_patch_version;
+    bool                    m_continuous;
+    int                     m_file_ring_size;
+    int                     m_sequence_first_image;
+
+    ProtocolLog             m_protocol_log;
+    bool                    m_replaying;
+
+    //Published cache variables, read without lock
+    Parameters              m_parameters;
+    volatile unsigned int   m_parameters_seq;	///< odd while publishing
 };
 }
 }
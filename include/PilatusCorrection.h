@@ -0,0 +1,105 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSCORRECTION_H
+#define PILATUSCORRECTION_H
+
+#include <string>
+#include <vector>
+#include "Debug.h"
+#include "SizeUtils.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class Correction
+ * \brief per pixel correction applied while the raw frame is read
+ *
+ * Mask (bad pixels included) and flat field are merged in one
+ * aligned float table in the raw detector layout: a negative
+ * value flags a masked pixel, otherwise it's the pixel gain.
+ * Files are read by prepare(), i.e once per acquisition, and
+ * only if they changed.
+ * - mask file: one byte per pixel, not 0 means masked
+ * - flat field file: one float32 gain per pixel
+ * Both may have a header (edf), it's skipped as the data are
+ * at the end of the file.
+ * Count rate (pile-up) correction uses the paralyzable model
+ * measured = true * exp(-true * tau / exposure). It's inverted once per
+ * acquisition in a lookup table sized from the counts of the frames
+ * already corrected, counts above the table are corrected one by one.
+ * Setters only flag the tables, they're rebuilt by prepare() so the
+ * frames being corrected are not disturbed.
+ *******************************************************************/
+class Correction
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"Correction","Pilatus");
+public:
+  enum {MASKED_VALUE = -2};	///< same as camserver bad pixels
+
+  Correction();
+  ~Correction();
+
+  void setDetectorSize(const Size&);
+
+  void setMaskFile(const std::string&);
+  const std::string& maskFile() const {return m_mask_file;}
+
+  void setFlatFieldFile(const std::string&);
+  const std::string& flatFieldFile() const {return m_flat_field_file;}
+
+  void setCountRateCorrection(bool);
+  bool countRateCorrection() const {return m_count_rate_correction;}
+  void setDeadTime(double tau);
+  double deadTime() const {return m_dead_time;}
+
+  void prepare(double exposure,int saturation_threshold);
+
+  bool isActive() const {return m_table || !m_lut.empty();}
+
+  void apply(int* dst,const int* src,long table_offset,int nb_pixels) const;
+private:
+  void _prepareTable();
+  void _prepareLut(double exposure,int saturation_threshold);
+  void _readFile(const std::string& path,void* data,long size,
+		 time_t& mtime) const;
+  void _freeTable();
+
+  Size		m_det_size;
+  std::string	m_mask_file;
+  std::string	m_flat_field_file;
+  time_t	m_mask_mtime;
+  time_t	m_flat_field_mtime;
+  bool		m_dirty;
+  float*	m_table;
+  bool		m_count_rate_correction;
+  double	m_dead_time;
+  bool		m_lut_dirty;
+  double	m_lut_exposure;
+  double	m_lut_k;	///< dead time / exposure of the table
+  std::vector<float> m_lut;	///< true counts for each measured count
+  mutable volatile int m_max_counts; ///< measured since the table was built
+};
+}
+}
+#endif//PILATUSCORRECTION_H
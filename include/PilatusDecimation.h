@@ -0,0 +1,75 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSDECIMATION_H
+#define PILATUSDECIMATION_H
+
+#include "Debug.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class Decimation
+ * \brief only some frames are given to Lima, i.e for live display
+ *
+ * - EveryNth: one frame out of N
+ * - FirstAfterPeriod: the first frame handled once the period since
+ *   the last delivered one is over. The time is when the file event
+ *   is handled, not when the frame was acquired, so a backlog in the
+ *   event thread delays the selection, and the delivered frame may be
+ *   up to one period older than the newest one.
+ * Discarded files are removed without being mapped. Delivered
+ * frames are numbered without hole. FirstAfterPeriod gives an unknown
+ * number of frames, so it's only for continuous acquisition.
+ *******************************************************************/
+class Decimation
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"Decimation","Pilatus");
+public:
+  enum Policy {Off,EveryNth,FirstAfterPeriod};
+
+  Decimation();
+
+  void setEveryNth(int nb_frames);
+  void setPeriod(double period);
+
+  Policy policy() const {return m_policy;}
+  int everyNth() const {return m_every_nth;}
+  double period() const {return m_period;}
+  bool isActive() const {return m_policy != Off;}
+
+  void prepare();
+  bool select(int& frame_nb);
+private:
+  static double _now();
+
+  Policy	m_policy;
+  int		m_every_nth;
+  double	m_period;
+  int		m_nb_candidates;
+  int		m_nb_delivered;
+  double	m_next_time;
+};
+}
+}
+#endif//PILATUSDECIMATION_H
@@ -0,0 +1,130 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSFRAMECACHE_H
+#define PILATUSFRAMECACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include "Debug.h"
+#include "ThreadUtils.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class FrameCache
+ * \brief decoded saved frames, least recently used evicted first
+ *
+ * Frames are keyed by their full path and modification time, so a
+ * file written again is decoded again. The cache keeps at most
+ * budget bytes of frames. A frame is shared by reference counting:
+ * an evicted frame still referenced is freed with its last Ref.
+ * A budget of 0 (the default) disables the cache.
+ *******************************************************************/
+class FrameCache
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"FrameCache","Pilatus");
+public:
+  struct Frame
+  {
+    int		width;
+    int		height;
+    int*	data;		///< posix_memalign, freed with the frame
+    long long	mem_size;
+    int		ref_count;
+  };
+
+  // counted reference on a frame
+  class Ref
+  {
+  public:
+    Ref() : m_frame(NULL) {}
+    Ref(const Ref& other) : m_frame(other.m_frame) {_get();}
+    ~Ref() {_put();}
+    Ref& operator=(const Ref& other)
+    {
+      if(other.m_frame != m_frame)
+	{
+	  _put();
+	  m_frame = other.m_frame;
+	  _get();
+	}
+      return *this;
+    }
+
+    bool isValid() const {return m_frame;}
+    const Frame* operator->() const {return m_frame;}
+    const Frame& operator*() const {return *m_frame;}
+  private:
+    friend class FrameCache;
+    explicit Ref(Frame* frame) : m_frame(frame) {_get();}
+    void _get();
+    void _put();
+
+    Frame*	m_frame;
+  };
+
+  struct Stats
+  {
+    long long	nb_hits;
+    long long	nb_misses;
+    long long	mem_size;	///< of the cached frames
+    int		nb_frames;
+  };
+
+  FrameCache();
+  ~FrameCache();
+
+  void setBudget(long long nb_bytes);
+  long long budget() const;
+  bool isActive() const {return budget() > 0;}
+
+  bool get(const std::string& full_path,long long mtime,Ref&);
+  Ref insert(const std::string& full_path,long long mtime,
+	     int width,int height,void* data);
+  void clear();
+  void getStats(Stats&) const;
+private:
+  typedef std::pair<std::string,long long> Key;
+  struct Entry
+  {
+    Key		key;
+    Ref		frame;
+  };
+  typedef std::list<Entry> EntryList;	///< most recently used first
+  typedef std::map<Key,EntryList::iterator> EntryMap;
+
+  void _evict(long long budget);
+
+  mutable Mutex	m_mutex;
+  long long	m_budget;
+  long long	m_mem_size;
+  EntryList	m_entries;
+  EntryMap	m_map;
+  long long	m_nb_hits;
+  long long	m_nb_misses;
+};
+}
+}
+#endif//PILATUSFRAMECACHE_H
@@ -0,0 +1,112 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSFRAMEINDEX_H
+#define PILATUSFRAMEINDEX_H
+
+#include <stdint.h>
+#include <string>
+#include "Debug.h"
+#include "ThreadUtils.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class FrameIndex
+ * \brief memory-mapped index of a saved CBF series
+ *
+ * One file per series (<directory>/<prefix>.index, the directory
+ * being the offload destination when offload is active) with a Header
+ * and one Record per file number, at
+ * sizeof(Header) + (file_number - first_number) * sizeof(Record).
+ * A record is filled when camserver closes the file, its valid
+ * field is written last. Readers (any process) can map the file
+ * and seek straight to the binary section; the file grows, so
+ * they must map it again when capacity is beyond their mapping.
+ * All fields are host endian.
+ *******************************************************************/
+class FrameIndex
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"FrameIndex","Pilatus");
+public:
+  enum Compression {Unknown,ByteOffset,Uncompressed};
+
+  struct Header
+  {
+    char	magic[8];		///< "PILFIDX2"
+    uint32_t	record_size;
+    int32_t	first_number;
+    int32_t	capacity;		///< records in the file
+    char	reserved[236];
+  };
+
+  struct Record
+  {
+    uint32_t	valid;
+    int32_t	file_number;
+    int64_t	binary_offset;		///< from the file start
+    int64_t	binary_size;		///< compressed size
+    int32_t	width;
+    int32_t	height;
+    int32_t	element_size;		///< decompressed, byte
+    int32_t	compression;
+    int32_t	is_signed;		///< element type
+    int32_t	padding;
+    double	exposure_time;		///< NaN if not in header
+    double	exposure_period;
+    double	start_angle;
+    double	angle_increment;
+    char	file_name[128];
+    char	reserved[48];
+  };
+
+  FrameIndex();
+  ~FrameIndex();
+
+  void open(const std::string& directory,const std::string& prefix,
+	    const std::string& suffix,int first_number);
+  void close();
+  bool isOpen() const;
+  const std::string& path() const {return m_path;}
+
+  bool add(const std::string& full_path);
+  bool lookup(int file_number,Record&) const;
+  int fileNumber(const std::string& file_name) const;
+
+  static bool parse(const char* data,long size,Record&);
+  static bool decodeByteOffset(const char* data,long size,
+			       int* pixels,long nb_pixels);
+private:
+  void _grow(int capacity);
+
+  mutable Mutex	m_mutex;
+  std::string	m_path;
+  std::string	m_prefix;
+  std::string	m_suffix;
+  int		m_fd;
+  Header*	m_header;
+  long		m_map_size;
+};
+}
+}
+#endif//PILATUSFRAMEINDEX_H
@@ -0,0 +1,145 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSINGEST_H
+#define PILATUSINGEST_H
+
+#include <vector>
+#include "Debug.h"
+#include "SizeUtils.h"
+#include "PilatusCorrection.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class ModuleGeometry
+ * \brief module tiling of a Pilatus detector
+ *
+ * Detector is made of 487x195 modules separated by 7 columns
+ * horizontally and 17 lines vertically. Module index is
+ * module_y * nbModuleX() + module_x.
+ *******************************************************************/
+class ModuleGeometry
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"ModuleGeometry","Pilatus");
+public:
+  enum {MODULE_WIDTH = 487, MODULE_HEIGHT = 195,
+	GAP_WIDTH = 7, GAP_HEIGHT = 17};
+
+  ModuleGeometry();
+  ModuleGeometry(const std::string& model,const Size& det_size);
+
+  bool isValid() const {return m_nb_module_x > 0;}
+  const std::string& model() const {return m_model;}
+  const Size& detectorSize() const {return m_det_size;}
+  Size compactedSize() const;
+
+  int nbModuleX() const {return m_nb_module_x;}
+  int nbModuleY() const {return m_nb_module_y;}
+  int nbModules() const {return m_nb_module_x * m_nb_module_y;}
+
+  Roi rawModuleRoi(int module) const;
+  Roi compactedModuleRoi(int module) const;
+  void getGapMask(std::vector<unsigned char>&) const;
+private:
+  std::string	m_model;
+  Size		m_det_size;
+  int		m_nb_module_x;
+  int		m_nb_module_y;
+};
+
+/*******************************************************************
+ * \class Ingest
+ * \brief transformation applied to the raw camserver frame
+ *
+ * The raw frame is the full detector frame mmapped from the tmpfs
+ * edf file. When no transformation is requested the raw frame is
+ * given as is to Lima (no copy), otherwise only the needed part
+ * of the raw frame is read and written in a new buffer.
+ * With gap compaction, the inter-module gaps are dropped. Binning is
+ * applied on the (compacted) frame and the roi is expressed in the
+ * binned layout as for any Lima hardware roi.
+ * Consecutive raw frames can also be summed into one delivered frame.
+ * Pixel correction, if any, is applied on each raw pixel while it's
+ * copied out of the file.
+ *******************************************************************/
+class Ingest
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"Ingest","Pilatus");
+public:
+  Ingest();
+  ~Ingest();
+
+  void setGeometry(const ModuleGeometry&);
+  const ModuleGeometry& geometry() const {return m_geometry;}
+  const Size& detectorSize() const {return m_geometry.detectorSize();}
+
+  void setGapCompaction(bool);
+  bool gapCompaction() const {return m_gap_compaction;}
+
+  void checkBin(Bin&) const;
+  void setBin(const Bin&);
+  void getBin(Bin&) const;
+
+  void checkRoi(const Roi& set_roi,Roi& hw_roi) const;
+  void setRoi(const Roi&);
+  void getRoi(Roi&) const;
+
+  void setCorrection(const Correction*);
+
+  void setNbFramesSummed(int);
+  int nbFramesSummed() const {return m_nb_frames_summed;}
+
+  void getImageSize(Size&) const;
+  bool isPassThrough() const;
+
+  void process(const int* src,int* dst) const;
+  void accumulate(const int* src,int* dst,std::vector<int>& scratch) const;
+private:
+  struct Run
+  {
+    int dst;
+    int src;
+    int len;
+  };
+  void _getSourceSize(Size&) const;
+  void _getBinnedSize(Size&) const;
+  bool _isIdentityLayout() const;
+  bool _isCorrected() const;
+  void _copyRun(int* dst,const int* src_line,long line_offset,
+		const Run&) const;
+  void _updateLayout();
+
+  ModuleGeometry	m_geometry;
+  bool			m_gap_compaction;
+  Bin			m_bin;
+  Roi			m_roi;
+  int			m_nb_frames_summed;
+  const Correction*	m_correction;
+  int			m_line_width;	///< source pixels read per line
+  std::vector<long>	m_line_offsets;	///< raw offset of each source line
+  std::vector<Run>	m_runs;		///< contiguous parts of a line
+};
+}
+}
+#endif//PILATUSINGEST_H
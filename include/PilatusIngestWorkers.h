@@ -0,0 +1,110 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSINGESTWORKERS_H
+#define PILATUSINGESTWORKERS_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "Debug.h"
+#include "ThreadUtils.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+class Ingest;
+class Placement;
+/*******************************************************************
+ * \class IngestWorkers
+ * \brief pool of threads reading the next camserver files
+ *
+ * Files are delivered to Lima in sequence by the directory event
+ * thread. Workers read ahead the files already written by
+ * camserver, in any order: open, map with the pages populated and
+ * if the ingest is not pass-through and not summed, run the ingest
+ * into a new frame buffer. The directory event thread takes the
+ * results in order, or does the work itself if the file wasn't
+ * read ahead. A file is read ahead only when it has its full size.
+ * With no worker (the default) every file is read inline.
+ *******************************************************************/
+class IngestWorkers
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"IngestWorkers","Pilatus");
+public:
+  struct Result
+  {
+    void*	map_base;	///< file mapping, NULL if already processed
+    long	map_length;
+    void*	buffer;		///< ingested frame (posix_memalign)
+  };
+
+  IngestWorkers(const Ingest&);
+  ~IngestWorkers();
+
+  void setNbWorkers(int nb_workers);
+  int nbWorkers() const;
+  void getThreadIds(std::vector<pthread_t>&) const;
+
+  void setPlacement(const Placement*);
+
+  void prepare(const std::string& watch_path,
+	       const std::string& file_pattern,
+	       long data_offset,long map_length,
+	       long frame_mem_size,bool process);
+  bool take(int image_number,int nb_images,Result&);
+  void release();
+private:
+  enum SlotState {Free,Pending,Running,Done,Missing};
+  struct Slot
+  {
+    Slot() : image_number(-1),state(Free) {}
+
+    int		image_number;
+    SlotState	state;
+    Result	result;
+  };
+
+  static void* _runFunc(void*);
+  void _run();
+  void _startThreads(int nb_workers);
+  void _stopThreads();
+  void _schedule(int first_image_number,int last_image_number);
+  bool _read(int image_number,Result&) const;
+  static void _free(const Result&);
+
+  const Ingest&			m_ingest;
+  const Placement*		m_placement;
+  mutable Cond			m_cond;
+  std::vector<pthread_t>	m_threads;
+  bool				m_quit;
+  std::vector<Slot>		m_slots;
+  std::string			m_watch_path;
+  std::string			m_file_pattern;
+  long				m_data_offset;
+  long				m_map_length;
+  long				m_frame_mem_size;
+  bool				m_process;
+};
+}
+}
+#endif//PILATUSINGESTWORKERS_H
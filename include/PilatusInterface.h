@@ -27,6 +27,16 @@
 #include "Debug.h"
 #include "PilatusCamera.h"
 #include "PilatusSaving.h"
+#include "PilatusIngest.h"
+#include "PilatusStatistics.h"
+#include "PilatusRoiCounters.h"
+#include "PilatusSparse.h"
+#include "PilatusIngestWorkers.h"
+#include "PilatusPlacement.h"
+#include "PilatusTiming.h"
+#include "PilatusLatencyCalibration.h"
+#include "PilatusDecimation.h"
+#include "PilatusReclaimer.h"
 
 namespace lima
 {
@@ -63,22 +73,37 @@ public:
 	virtual void getDetectorType(std::string& det_type);
 	virtual void getDetectorModel(std::string& det_model);
 
-	virtual void registerMaxImageSizeCallback(HwMaxImageSizeCallback&)
+	virtual void registerMaxImageSizeCallback(HwMaxImageSizeCallback& cb)
 	{
-		;
+		m_mis_cb_gen.registerMaxImageSizeCallback(cb);
 	}
 	;
-	virtual void unregisterMaxImageSizeCallback(HwMaxImageSizeCallback&)
+	virtual void unregisterMaxImageSizeCallback(HwMaxImageSizeCallback& cb)
 	{
-		;
+		m_mis_cb_gen.unregisterMaxImageSizeCallback(cb);
 	}
 	;
 
 	double getMinLatTime() const;
 	bool isPilatus3() const {return m_is_pilatus3;}
+	ModelTiming getModelTiming() const;
+	const std::string& getModel() const {return m_info.m_det_model;}
+
+	ModuleGeometry getModuleGeometry() const;
+	void setGapCompaction(bool);
+	bool getGapCompaction() const {return m_gap_compaction;}
 private:
+	class MaxImageSizeCallbackGen: public HwMaxImageSizeCallbackGen
+	{
+	  friend class DetInfoCtrlObj;
+	protected:
+	  virtual void setMaxImageSizeCallbackActive(bool) {}
+	};
+
 	Info	m_info;
         bool    m_is_pilatus3;
+	bool	m_gap_compaction;
+	MaxImageSizeCallbackGen m_mis_cb_gen;
 };
 /*******************************************************************
  * \class SyncCtrlObj
@@ -109,13 +134,76 @@ public:
 
 	virtual void getValidRanges(ValidRangesType& valid_ranges);
 
+	void setNbFramesSummed(int nb_frames);
+	void setDecimation(Decimation::Policy,int every_nth);
+
+	ModelTiming getModelTiming() const;
+	double getExposurePeriod(double exposure) const;
+	void setMinLatTime(double lat_time);
+	bool isContinuous() const;
+
 	void prepareAcq();
 	
 private:
 	Camera& m_cam;
+	DetInfoCtrlObj& m_det_info;
 	int m_nb_frames;
 	double m_exposure_requested;
 	double m_latency;
+	double m_min_latency;	///< calibrated, < 0 model readout time
+	int m_nb_frames_summed;
+	Decimation::Policy m_decimation_policy;
+	int m_decimation_every_nth;
+};
+
+/*******************************************************************
+ * \class RoiCtrlObj
+ * \brief Control object providing Pilatus roi interface
+ *
+ * camserver saving writes full frames, the hardware roi is then the
+ * full frame and Lima does it in software.
+ *******************************************************************/
+
+class RoiCtrlObj: public HwRoiCtrlObj
+{
+DEB_CLASS_NAMESPC(DebModCamera, "RoiCtrlObj", "Pilatus");
+
+public:
+	RoiCtrlObj(Ingest&,const SavingCtrlObj&);
+	virtual ~RoiCtrlObj();
+
+	virtual void checkRoi(const Roi& set_roi, Roi& hw_roi);
+	virtual void setRoi(const Roi& set_roi);
+	virtual void getRoi(Roi& hw_roi);
+
+private:
+	Ingest& m_ingest;
+	const SavingCtrlObj& m_saving;
+};
+
+/*******************************************************************
+ * \class BinCtrlObj
+ * \brief Control object providing Pilatus binning interface
+ *
+ * camserver saving writes full frames, the hardware binning is then
+ * 1x1 and Lima does it in software.
+ *******************************************************************/
+
+class BinCtrlObj: public HwBinCtrlObj
+{
+DEB_CLASS_NAMESPC(DebModCamera, "BinCtrlObj", "Pilatus");
+
+public:
+	BinCtrlObj(Ingest&,const SavingCtrlObj&);
+	virtual ~BinCtrlObj();
+
+	virtual void setBin(const Bin& bin);
+	virtual void getBin(Bin& bin);
+	virtual void checkBin(Bin& bin);
+
+private:
+	Ingest& m_ingest;
+	const SavingCtrlObj& m_saving;
 };
 
 /*******************************************************************
@@ -148,17 +236,157 @@ public:
 	Camera::Gain getGain(void);
 	void sendAnyCommand(const std::string& str);
 
+	void setGapCompaction(bool);
+	bool getGapCompaction() const;
+	const ModuleGeometry& getModuleGeometry() const;
+
+	void setNbFramesSummed(int nb_frames);
+	int getNbFramesSummed() const;
+
+	void setMaskFile(const std::string& path);
+	const std::string& getMaskFile() const;
+	void setFlatFieldFile(const std::string& path);
+	const std::string& getFlatFieldFile() const;
+
+	void setCountRateCorrection(bool);
+	bool getCountRateCorrection() const;
+	void setDeadTime(double tau);
+	double getDeadTime() const;
+
+	void setStatisticsActive(bool);
+	bool getStatisticsActive() const;
+	void setSaturationThreshold(int threshold);
+	int getSaturationThreshold() const;
+	bool getFrameStatistics(int frame_nb,Statistics::Result&) const;
+	int getLastStatisticsFrameNb() const;
+
+	void setRoiCounters(const std::vector<Roi>& rois);
+	const std::vector<Roi>& getRoiCounters() const;
+	void setRoiCountersMode(bool);
+	bool getRoiCountersMode() const;
+	void setRoiCountersFifoSize(int nb_frames);
+	int getRoiCountersFifoSize() const;
+	int readRoiCounters(std::vector<int>& frame_nbs,
+			    std::vector<long long>& sums,
+			    int max_nb_frames = -1,double timeout = 0.);
+	int getRoiCountersLostFrames() const;
+
+	void setSparseMode(bool);
+	bool getSparseMode() const;
+	void setSparseFifoSize(int nb_frames);
+	int getSparseFifoSize() const;
+	int readSparseFrames(std::vector<SparseFrame>& frames,
+			     int max_nb_frames = -1,double timeout = 0.);
+	int getSparseLostFrames() const;
+
+	void setNbIngestWorkers(int nb_workers);
+	int getNbIngestWorkers() const;
+
+	void setThreadCpus(Placement::ThreadRole,const std::string& cpus);
+	const std::string& getThreadCpus(Placement::ThreadRole) const;
+	void setMemoryPolicy(Placement::MemoryPolicy,const std::string& nodes = "");
+	Placement::MemoryPolicy getMemoryPolicy() const;
+	const std::string& getMemoryNodes() const;
+	std::string getPlacementReport() const;
+
+	ModelTiming getModelTiming() const;
+	double getExposurePeriod(double exposure) const;
+
+	double calibrateLatency(double exposure,bool verify = false);
+	bool loadLatencyCalibration(double exposure);
+	void setLatencyCacheFile(const std::string& path);
+	const std::string& getLatencyCacheFile() const;
+
+	void setFileRingSize(int nb_files);
+	int getFileRingSize() const;
+
+	void setDecimationEveryNth(int nb_frames);
+	void setDecimationPeriod(double period);
+	Decimation::Policy getDecimationPolicy() const;
+	int getDecimationEveryNth() const;
+	double getDecimationPeriod() const;
+
+	void setOffloadDestination(const std::string& path);
+	const std::string& getOffloadDestination() const;
+	void setOffloadNbCopies(int nb_copies);
+	int getOffloadNbCopies() const;
+	void getOffloadStats(Offload::Stats&) const;
+	void resetOffloadStats();
+	bool waitOffload(double timeout = -1.);
+
+	void setHeaderQueued(bool);
+	bool getHeaderQueued() const;
+	void resetHeaderCache();
+
+	void setFrameIndexActive(bool);
+	bool getFrameIndexActive() const;
+	const std::string& getFrameIndexPath() const;
+
+	void setFrameCacheSize(long long nb_bytes);
+	long long getFrameCacheSize() const;
+	void getFrameCacheStats(FrameCache::Stats&) const;
+	void clearFrameCache();
+
 private:
 	class _BufferCallback;
 	friend class _BufferCallback;
+	friend class FrameView;
+
+	void _applyWorkerCpus();
+	bool _pinFrame(int frame_nb,void*& data,FrameDim& frame_dim);
+	void _unpinFrame(void* data);
 
 	Camera& m_cam;
 	CapList m_cap_list;
 	DetInfoCtrlObj m_det_info;
+	Correction m_correction;
+	Ingest m_ingest;
+	Statistics m_statistics;
+	RoiCounters m_roi_counters;
+	SparseFrames m_sparse_frames;
+	Decimation m_decimation;
+	Placement m_placement;
+	IngestWorkers m_ingest_workers;
+	Reclaimer m_reclaimer;
 	_BufferCallback* m_buffer_cbk;
 	HwTmpfsBufferMgr m_buffer;
 	SyncCtrlObj m_sync;
+	RoiCtrlObj m_roi;
+	BinCtrlObj m_bin;
 	SavingCtrlObj m_saving;
+	LatencyCalibration m_latency_calibration;
+};
+
+/*******************************************************************
+ * \class FrameView
+ * \brief read-only access to a frame still mapped by the plugin
+ *
+ * The frame buffer isn't unmapped while a view holds it, even if
+ * Lima released it.
+ *******************************************************************/
+class FrameView
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "FrameView", "Pilatus");
+
+public:
+	FrameView(Interface&,int frame_nb);
+	~FrameView();
+
+	int frameNb() const {return m_frame_nb;}
+	int width() const {return m_frame_dim.getSize().getWidth();}
+	int height() const {return m_frame_dim.getSize().getHeight();}
+	int depth() const {return m_frame_dim.getDepth();}
+	const void* data() const {return m_data;}
+	long size() const {return m_frame_dim.getMemSize();}
+
+private:
+	FrameView(const FrameView&);
+	FrameView& operator=(const FrameView&);
+
+	Interface& m_interface;
+	int m_frame_nb;
+	void* m_data;
+	FrameDim m_frame_dim;
 };
 
 } // namespace Pilatus
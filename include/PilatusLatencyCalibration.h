@@ -0,0 +1,87 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSLATENCYCALIBRATION_H
+#define PILATUSLATENCYCALIBRATION_H
+
+#include <string>
+#include "Debug.h"
+#include "PilatusCamera.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class LatencyCalibration
+ * \brief minimum latency measured on the detector
+ *
+ * camserver refuses a too short exposure period, the shortest
+ * accepted one is found by binary search on expperiod (1 us
+ * resolution). It can be checked with a short internal trigger
+ * acquisition, the latency is increased by 10% until all the frames
+ * are acquired. Its files are written in the verify path (the tmpfs)
+ * with the verify pattern and removed, the camera image path, file
+ * name, trigger mode and number of images are restored. Results are
+ * cached in a text file, one line per model, camserver version,
+ * trigger mode and exposure.
+ *******************************************************************/
+class LatencyCalibration
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"LatencyCalibration","Pilatus");
+public:
+  enum {DEFAULT_NB_VERIFY_FRAMES = 20};
+
+  LatencyCalibration(Camera&,const std::string& verify_path,
+		     const std::string& verify_pattern);
+  ~LatencyCalibration();
+
+  void setCacheFile(const std::string&);
+  const std::string& cacheFile() const {return m_cache_file;}
+
+  double calibrate(const std::string& model,double exposure,
+		   bool verify = false,
+		   int nb_verify_frames = DEFAULT_NB_VERIFY_FRAMES);
+  bool lookup(const std::string& model,double exposure,
+	      double& latency) const;
+private:
+  struct _Setup
+  {
+    Camera::TriggerMode	trigger_mode;
+    int			nb_images;
+    std::string		imgpath;
+    std::string		file_name;
+  };
+
+  bool _isAccepted(double exposure_period);
+  bool _verify(double exposure,double latency,int nb_frames);
+  void _restore(const _Setup&,int nb_frames);
+  std::string _key(const std::string& model) const;
+  void _save(const std::string& model,double exposure,double latency);
+
+  Camera&	m_cam;
+  std::string	m_cache_file;
+  std::string	m_verify_path;
+  std::string	m_verify_pattern;
+};
+}
+}
+#endif//PILATUSLATENCYCALIBRATION_H
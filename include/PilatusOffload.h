@@ -0,0 +1,120 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSOFFLOAD_H
+#define PILATUSOFFLOAD_H
+
+#include <pthread.h>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+#include "Debug.h"
+#include "ThreadUtils.h"
+#include "PilatusFrameIndex.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class Offload
+ * \brief moves the saved files from the ramdisk to the final storage
+ *
+ * A watcher thread gets the files closed by camserver in the saving
+ * directory (inotify) and queues the ones matching the saving prefix
+ * and suffix. Copy threads (the bounded concurrency) copy them with
+ * copy_file_range into the destination directory, under a temporary
+ * name renamed once synced, then remove the ramdisk file.
+ * The watcher also fills the frame index if any, before the copy.
+ * If the inotify queue overflows, events are lost: the directory is
+ * rescanned for the files of the series not queued yet.
+ *******************************************************************/
+class Offload
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"Offload","Pilatus");
+public:
+  enum {DEFAULT_NB_COPIES = 4};
+
+  struct Stats
+  {
+    int		nb_files;	///< offloaded
+    int		nb_failed;
+    int		nb_pending;	///< queued or being copied
+    long long	nb_bytes;
+    double	busy_time;	///< second with at least one copy running
+    double	throughput;	///< byte/s during busy time
+  };
+
+  Offload();
+  ~Offload();
+
+  void setDestination(const std::string& path);
+  const std::string& destination() const {return m_destination;}
+  bool isActive() const {return !m_destination.empty();}
+
+  void setFrameIndex(FrameIndex*);
+
+  void setNbCopies(int nb_copies);
+  int nbCopies() const {return m_nb_copies;}
+
+  void watch(const std::string& directory,
+	     const std::string& prefix,const std::string& suffix);
+  bool wait(double timeout = -1.);
+  void getStats(Stats&) const;
+  void resetStats();
+
+  std::string offloadedPath(const std::string& full_path) const;
+private:
+  static void* _watchFunc(void*);
+  static void* _copyFunc(void*);
+  void _watch();
+  void _copy();
+  bool _rescan(std::vector<std::string>& full_paths) const;
+  static bool _copyFile(const std::string& full_path,
+			const std::string& destination,long long& nb_bytes);
+  void _restart();
+  void _start();
+  void _stop();
+  static double _now();
+
+  mutable Cond			m_cond;
+  std::string			m_destination;
+  int				m_nb_copies;
+  FrameIndex*			m_frame_index;
+  bool				m_quit;
+  pthread_t			m_watch_thread;
+  std::vector<pthread_t>	m_copy_threads;
+  int				m_inotify_fd;
+  int				m_watch_descriptor;
+  int				m_wake_pipe[2];
+  std::string			m_directory;
+  std::string			m_prefix;
+  std::string			m_suffix;
+  std::deque<std::string>	m_queue;	///< full paths on the ramdisk
+  std::set<std::string>		m_copying;	///< being copied
+  int				m_nb_running;
+  double			m_busy_start;
+  Stats				m_stats;
+};
+}
+}
+#endif//PILATUSOFFLOAD_H
@@ -0,0 +1,89 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSPLACEMENT_H
+#define PILATUSPLACEMENT_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "Debug.h"
+#include "ThreadUtils.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class Placement
+ * \brief cpu and numa node placement of the plugin threads and buffers
+ *
+ * Each thread role can be pinned to a cpu list ("0-7,16-23", empty
+ * means all cpus). Frame buffers allocated by the plugin (ingested,
+ * summed) can be bound or interleaved on a node list, the policy is
+ * set before the pages are touched. camserver files pages are
+ * allocated by camserver, they are only reported.
+ * No libnuma dependency, the kernel is called directly.
+ *******************************************************************/
+class Placement
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"Placement","Pilatus");
+public:
+  enum ThreadRole {CameraThread,EventThread,WorkerThreads,NB_ROLES};
+  enum MemoryPolicy {Default,Bind,Interleave};
+
+  Placement();
+  ~Placement();
+
+  void setCpus(ThreadRole,const std::string& cpus);
+  const std::string& cpus(ThreadRole) const;
+
+  void setMemoryPolicy(MemoryPolicy,const std::string& nodes = "");
+  MemoryPolicy memoryPolicy() const {return m_memory_policy;}
+  const std::string& memoryNodes() const {return m_memory_nodes;}
+
+  void applyCpus(ThreadRole,pthread_t) const;
+  void applyToEventThread();
+  void bindMemory(void* address,long length) const;
+  static int allocateFrame(void** buffer,long length);
+  void sampleFrame(const void* raw,const void* buffer);
+
+  std::string report(pthread_t camera_thread,
+		     const std::vector<pthread_t>& worker_threads) const;
+private:
+  static std::string _threadCpus(pthread_t);
+  static int _node(const void* address);
+
+  std::string		m_cpus[NB_ROLES];
+  MemoryPolicy		m_memory_policy;
+  std::string		m_memory_nodes;
+  unsigned long		m_node_mask;
+  mutable Mutex		m_mutex;
+  volatile int		m_generation;	///< bumped when event thread cpus change
+  int			m_event_generation;
+  bool			m_event_thread_known;
+  pthread_t		m_event_thread;
+  int			m_raw_node;	///< last sampled frame
+  int			m_buffer_node;
+};
+}
+}
+#endif//PILATUSPLACEMENT_H
@@ -0,0 +1,99 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSPROTOCOLLOG_H
+#define PILATUSPROTOCOLLOG_H
+
+#include <stdio.h>
+#include <string>
+#include "Debug.h"
+#include "ThreadUtils.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class ProtocolLog
+ * \brief binary log of a camserver session
+ *
+ * Every command sent and every chunk received by the camera thread
+ * is appended with its time since the opening of the log. A record
+ * is a 14 bytes header (type, camera status, size, time in ns)
+ * followed by the raw bytes, so a session can be replayed through
+ * the reply parser with Camera::replay. A chunk is recorded when
+ * received, before it's parsed, the camera status after the parsing
+ * follows in a STATUS record without data. Each record is flushed,
+ * nothing is lost if the process crashes.
+ *******************************************************************/
+class ProtocolLog
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"ProtocolLog","Pilatus");
+public:
+  enum Type {SENT,RECEIVED,DISCONNECTED,STATUS};
+
+  struct Record
+  {
+    Type	type;
+    int		status;		///< camera status when recorded
+    long long	timestamp;	///< ns since the opening of the log
+    std::string	data;
+  };
+
+  /** \class ProtocolLog::Reader
+      \brief sequential reading of a recorded session
+  */
+  class Reader
+  {
+    DEB_CLASS_NAMESPC(DebModCamera,"ProtocolLog::Reader","Pilatus");
+  public:
+    explicit Reader(const std::string& path);
+    ~Reader();
+
+    bool next(Record&);
+    long long startTime() const {return m_start_time;}
+  private:
+    FILE*	m_file;
+    long long	m_start_time;	///< ns since epoch
+  };
+
+  ProtocolLog();
+  ~ProtocolLog();
+
+  void open(const std::string& path);
+  void close();
+  bool isOpen() const;
+  const std::string& path() const {return m_path;}
+
+  void record(Type,int status,const char* data,int size);
+  long long nbRecords() const;
+private:
+  static long long _now();
+
+  mutable Mutex	m_mutex;
+  FILE*		m_file;
+  std::string	m_path;
+  long long	m_start;
+  long long	m_nb_records;
+};
+}
+}
+#endif//PILATUSPROTOCOLLOG_H
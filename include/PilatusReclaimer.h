@@ -0,0 +1,85 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSRECLAIMER_H
+#define PILATUSRECLAIMER_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "Debug.h"
+#include "ThreadUtils.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class Reclaimer
+ * \brief thread releasing the consumed frames off the hot path
+ *
+ * Lima threads releasing a buffer and the directory event thread
+ * only queue the mappings, buffers and files to reclaim. The
+ * reclaimer thread takes them by batches (up to BATCH_SIZE or after
+ * BATCH_DELAY) to munmap, free and unlink them. Built with
+ * WITH_IO_URING, the unlinks of a batch are submitted at once with
+ * io_uring (kernel >= 5.11), falling back to unlink(2) otherwise.
+ *******************************************************************/
+class Reclaimer
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"Reclaimer","Pilatus");
+public:
+  enum {BATCH_SIZE = 64};
+
+  Reclaimer();
+  ~Reclaimer();
+
+  void unmap(void* base,long length);
+  void free(void* buffer);
+  void unlink(const char* full_path);
+  void flush();
+
+  long long nbReclaimed() const;
+private:
+  struct Item
+  {
+    void*	base;
+    long	length;		///< 0 if buffer must be freed
+  };
+
+  static void* _runFunc(void*);
+  void _run();
+  void _reclaim(std::vector<Item>&,std::vector<std::string>&);
+  void _unlink(std::vector<std::string>&);
+  void _push();
+
+  mutable Cond			m_cond;
+  pthread_t			m_thread_id;
+  bool				m_quit;
+  bool				m_busy;
+  std::vector<Item>		m_items;
+  std::vector<std::string>	m_paths;
+  long long			m_nb_reclaimed;
+  void*				m_ring;		///< io_uring if available
+};
+}
+}
+#endif//PILATUSRECLAIMER_H
@@ -0,0 +1,90 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSROICOUNTERS_H
+#define PILATUSROICOUNTERS_H
+
+#include <vector>
+#include "Debug.h"
+#include "SizeUtils.h"
+#include "ThreadUtils.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class RoiCounters
+ * \brief roi sums streamed instead of images
+ *
+ * When active, the sum of each roi is computed directly on the
+ * mapped raw file, then the file is removed, no image is given to
+ * Lima. Rois are in raw detector coordinates, negative pixels
+ * (gap, bad) are ignored and only the rows of the rois are read.
+ * Counters are queued in a bounded fifo of frames: readCounters()
+ * pops them, if the reader is too slow the oldest frames are
+ * overwritten and counted as lost.
+ *******************************************************************/
+class RoiCounters
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"RoiCounters","Pilatus");
+public:
+  enum {DEFAULT_FIFO_SIZE = 16384};
+
+  RoiCounters();
+  ~RoiCounters();
+
+  void setDetectorSize(const Size&);
+
+  void setActive(bool);
+  bool isActive() const {return m_active;}
+
+  void setRois(const std::vector<Roi>&);
+  const std::vector<Roi>& rois() const {return m_rois;}
+
+  void setFifoSize(int nb_frames);
+  int fifoSize() const {return m_fifo_size;}
+
+  void prepare();
+  void compute(int frame_nb,const int* raw);
+
+  int readCounters(std::vector<int>& frame_nbs,
+		   std::vector<long long>& sums,
+		   int max_nb_frames = -1,double timeout = 0.);
+  int nbLostFrames() const;
+  int lastFrameNb() const;
+private:
+  Size			m_det_size;
+  bool			m_active;
+  std::vector<Roi>	m_rois;
+  int			m_fifo_size;
+  mutable Cond		m_cond;
+  std::vector<int>	m_frame_nbs;	///< fifo of frame numbers
+  std::vector<long long> m_sums;	///< fifo of nb rois sums
+  int			m_read_index;
+  int			m_nb_available;
+  int			m_nb_lost;
+  int			m_last_frame_nb;
+  std::vector<long long> m_frame_sums;	///< computation scratch
+};
+}
+}
+#endif//PILATUSROICOUNTERS_H
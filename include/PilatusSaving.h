@@ -19,9 +19,16 @@
 // You should have received a copy of the GNU General Public License
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
+#include <stdio.h>
 #include <set>
 #include <string>
+#include <vector>
 #include "HwSavingCtrlObj.h"
+#include "ThreadUtils.h"
+#include "PilatusFrameIndex.h"
+#include "PilatusOffload.h"
+#include "PilatusBatchReader.h"
+#include "PilatusFrameCache.h"
 
 namespace lima
 {
@@ -40,12 +47,43 @@ namespace lima
       virtual void getPossibleSaveFormat(std::list<std::string> &format_list) const;
 
       virtual void readFrame(HwFrameInfoType&,int frame_nr);
+      void readFrames(std::vector<HwFrameInfoType>&,
+		      int first_frame_nr,int nb_frames);
+      void getFrame(FrameCache::Ref&,int frame_nr);
 
       virtual void setCommonHeader(const HeaderMap&);
+      void setHeaderQueued(bool);
+      bool isHeaderQueued() const {return m_header_queued;}
+      void resetHeaderCache();
+
+      Offload& offload() {return m_offload;}
+      const Offload& offload() const {return m_offload;}
+
+      void setFrameIndexActive(bool);
+      bool isFrameIndexActive() const {return m_frame_index_active;}
+      const FrameIndex& frameIndex() const {return m_frame_index;}
+
+      FrameCache& frameCache() {return m_frame_cache;}
+      const FrameCache& frameCache() const {return m_frame_cache;}
     private:
       void _prepare();
+      void _readFrame(HwFrameInfoType&,int frame_nr);
+      void _decode(FILE*,const std::string& fullPath,
+		   int frame_nr,HwFrameInfoType&);
+      bool _readIndexed(const std::string& fullPath,
+			int frame_nr,HwFrameInfoType&);
+      static std::string _headerCommand(const HeaderMap&);
 
       Camera& 		m_cam;
+      FrameIndex	m_frame_index;	///< filled by the offload watcher
+      bool		m_frame_index_active;
+      Offload		m_offload;
+      BatchReader	m_batch_reader;
+      Mutex		m_batch_mutex;
+      FrameCache	m_frame_cache;
+      HeaderMap		m_applied_header; ///< last values sent to camserver
+      HeaderMap		m_pending_header; ///< queued, sent at prepare
+      bool		m_header_queued;
     };
   }
 }
@@ -0,0 +1,98 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSSPARSE_H
+#define PILATUSSPARSE_H
+
+#include <vector>
+#include "Debug.h"
+#include "SizeUtils.h"
+#include "ThreadUtils.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class SparseFrame
+ * \brief frame stored as (pixel index, count) of its hit pixels
+ *
+ * Only pixels > 0 are kept, zero, gap and masked pixels are all
+ * restored to 0 by decode().
+ *******************************************************************/
+struct SparseFrame
+{
+  SparseFrame() : frame_nb(-1) {}
+
+  void encode(int frame_nb,const Size& size,const int* data);
+  void decode(int* dst) const;
+  void swap(SparseFrame&);
+
+  int			frame_nb;
+  Size			size;
+  std::vector<int>	indices;
+  std::vector<int>	counts;
+};
+
+/*******************************************************************
+ * \class SparseFrames
+ * \brief sparse encoding of the ingested frames
+ *
+ * When active, frames are encoded and dropped instead of being
+ * given to Lima, their files are removed once read. Encoded frames are queued in a bounded fifo,
+ * readFrames() pops them, if the reader is too slow the oldest are
+ * overwritten and counted as lost. Vectors of the fifo slots are
+ * recycled so the steady state doesn't allocate.
+ *******************************************************************/
+class SparseFrames
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"SparseFrames","Pilatus");
+public:
+  enum {DEFAULT_FIFO_SIZE = 1024};
+
+  SparseFrames();
+  ~SparseFrames();
+
+  void setActive(bool);
+  bool isActive() const {return m_active;}
+
+  void setFifoSize(int nb_frames);
+  int fifoSize() const {return m_fifo_size;}
+
+  void prepare();
+  void encode(int frame_nb,const Size& size,const int* data);
+
+  int readFrames(std::vector<SparseFrame>& frames,
+		 int max_nb_frames = -1,double timeout = 0.);
+  int nbLostFrames() const;
+private:
+  bool				m_active;
+  int				m_fifo_size;
+  mutable Cond			m_cond;
+  std::vector<SparseFrame>	m_fifo;
+  int				m_read_index;
+  int				m_nb_available;
+  int				m_nb_lost;
+  SparseFrame			m_scratch;
+};
+}
+}
+#endif//PILATUSSPARSE_H
@@ -0,0 +1,87 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSSTATISTICS_H
+#define PILATUSSTATISTICS_H
+
+#include <vector>
+#include "Debug.h"
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class Statistics
+ * \brief per frame statistics computed at ingest
+ *
+ * Sum, max, number of saturated pixels and a log2 histogram are
+ * computed in one pass on each frame given to Lima. Negative
+ * pixels (gap, bad, masked) are ignored. Histogram bin 0 counts
+ * the pixels at 0 and bin n the pixels in [2^(n-1),2^n[.
+ * Results are kept in a ring of the last frames: one writer (the
+ * ingest) and any readers without lock, each slot is protected by
+ * a sequence number.
+ *******************************************************************/
+class Statistics
+{
+  DEB_CLASS_NAMESPC(DebModCamera,"Statistics","Pilatus");
+public:
+  enum {NB_HISTOGRAM_BINS = 32};
+  enum {DEFAULT_RING_SIZE = 1024};
+
+  struct Result
+  {
+    int		frame_nb;
+    long long	sum;
+    int		max;
+    int		nb_saturated;
+    int		histogram[NB_HISTOGRAM_BINS];
+  };
+
+  Statistics(int ring_size = DEFAULT_RING_SIZE);
+  ~Statistics();
+
+  void setActive(bool);
+  bool isActive() const {return m_active;}
+
+  void setSaturationThreshold(int);
+  int saturationThreshold() const {return m_saturation_threshold;}
+
+  void reset();
+  void compute(int frame_nb,const int* data,long nb_pixels);
+  bool get(int frame_nb,Result&) const;
+  int lastFrameNb() const;
+private:
+  struct Slot
+  {
+    volatile unsigned	sequence;	///< odd while written
+    Result		result;
+  };
+
+  bool			m_active;
+  int			m_saturation_threshold;
+  std::vector<Slot>	m_ring;
+  volatile int		m_last_frame_nb;
+};
+}
+}
+#endif//PILATUSSTATISTICS_H
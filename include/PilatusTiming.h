@@ -0,0 +1,57 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef PILATUSTIMING_H
+#define PILATUSTIMING_H
+
+#include <string>
+
+namespace lima
+{
+namespace Pilatus
+{
+/*******************************************************************
+ * \class ModelTiming
+ * \brief timing limits of a detector model
+ *
+ * Looked up in a static table with the camera_name of camera.def
+ * (i.e "PILATUS3 2M, S/N 24-0106"): the entry with the longest
+ * matching model prefix wins. Unknown models get the family
+ * defaults.
+ *******************************************************************/
+struct ModelTiming
+{
+  std::string	model;		///< matched model prefix
+  double	readout_time;	///< minimum latency (s)
+  double	max_frame_rate;	///< Hz, 0 if unknown
+  double	min_exposure;	///< s
+  int		counter_bits;
+
+  ModelTiming();
+
+  static ModelTiming find(const std::string& camera_name);
+
+  double minPeriod(double exposure) const;
+  int counterMax() const {return (1 << counter_bits) - 1;}
+};
+}
+}
+#endif//PILATUSTIMING_H
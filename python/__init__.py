@@ -34,6 +34,83 @@ cleanup_data = module_helper.load_dep_cleanup(cleanup_data)
 from Lima.Pilatus.limapilatus import Pilatus as _P
 globals().update(_P.__dict__)
 
+# awaitable variants of the calls waiting for camserver, run one
+# at a time in a thread of the object so its commands keep their order
+try:
+    import asyncio
+    import concurrent.futures
+    import functools
+    import threading
+except ImportError:
+    asyncio = None
+
+_ASYNC_METHODS = {
+    'Camera': ['setEnergy', 'setThresholdGain', 'setThreshold',
+               'setExposure', 'setExposurePeriod', 'setNbImagesInSequence',
+               'setHardwareTriggerDelay', 'setNbExposurePerFrame',
+               'setTriggerMode', 'startAcquisition', 'stopAcquisition',
+               'setGapfill', 'sendAnyCommand', 'sendAnyCommandAndGetErrorMsg'],
+    'Interface': ['setEnergy', 'setThresholdGain', 'setThreshold',
+                  'sendAnyCommand', 'prepareAcq', 'startAcq', 'stopAcq',
+                  'calibrateLatency'],
+}
+
+# one executor per detector, kept by its Camera so the calls through
+# the Interface and the Camera share it; a slow command on one
+# detector doesn't delay the others
+_command_executor_lock = threading.Lock() if asyncio is not None else None
+
+def _get_command_executor(obj):
+    cam = getattr(obj, '_camera', obj)
+    with _command_executor_lock:
+        executor = getattr(cam, '_command_executor', None)
+        if executor is None:
+            executor = concurrent.futures.ThreadPoolExecutor(max_workers=1)
+            cam._command_executor = executor
+        return executor
+
+if asyncio is not None:
+    # get_running_loop is python >= 3.7
+    _get_loop = getattr(asyncio, 'get_running_loop', asyncio.get_event_loop)
+
+def _make_async(method):
+    def async_method(self, *args, **kwargs):
+        loop = _get_loop()
+        call = functools.partial(method, self, *args, **kwargs)
+        return loop.run_in_executor(_get_command_executor(self), call)
+    async_method.__name__ = method.__name__ + '_async'
+    async_method.__doc__ = 'awaitable %s, run in the command thread' % \
+                           method.__name__
+    return async_method
+
+_Interface_init = Interface.__init__
+
+def _interface_init(self, cam, *args, **kwargs):
+    _Interface_init(self, cam, *args, **kwargs)
+    self._camera = cam
+
+Interface.__init__ = _interface_init
+
+if asyncio is not None:
+    for _class_name, _method_names in _ASYNC_METHODS.items():
+        _class = globals()[_class_name]
+        for _method_name in _method_names:
+            setattr(_class, _method_name + '_async',
+                    _make_async(getattr(_class, _method_name)))
+    del _class_name, _method_names, _class, _method_name
+
+# numpy array on a frame still mapped, without copy;
+# the frame stays mapped as long as the array is alive
+_FRAME_DTYPES = {1: 'uint8', 2: 'uint16', 4: 'int32'}
+
+def _getFrameArray(self, frame_nb):
+    import numpy
+    view = FrameView(self, frame_nb)
+    data = numpy.frombuffer(view, dtype=_FRAME_DTYPES[view.depth()])
+    return data.reshape(view.height(), view.width())
+
+Interface.getFrameArray = _getFrameArray
+
 module_helper.load_cleanup(cleanup_data)
 
 
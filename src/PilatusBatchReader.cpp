@@ -0,0 +1,225 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef WITH_IO_URING
+#include <liburing.h>
+#endif
+#include "Exceptions.h"
+#include "PilatusBatchReader.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+BatchReader::BatchReader() :
+  m_ring(NULL)
+{
+  DEB_CONSTRUCTOR();
+#ifdef WITH_IO_URING
+  struct io_uring* ring = new struct io_uring;
+  if(io_uring_queue_init(QUEUE_DEPTH * 2,ring,0))
+    {
+      DEB_WARNING() << "io_uring not available, files will be read one by one";
+      delete ring;
+    }
+  else
+    m_ring = ring;
+#endif
+}
+
+BatchReader::~BatchReader()
+{
+  DEB_DESTRUCTOR();
+#ifdef WITH_IO_URING
+  if(m_ring)
+    {
+      io_uring_queue_exit((struct io_uring*)m_ring);
+      delete (struct io_uring*)m_ring;
+    }
+#endif
+}
+//-----------------------------------------------------
+// fill data and size of each file, data is NULL on error.
+// Up to QUEUE_DEPTH files.
+//-----------------------------------------------------
+void BatchReader::read(std::vector<File>& files)
+{
+  DEB_MEMBER_FUNCT();
+
+  if(files.size() > QUEUE_DEPTH)
+    THROW_HW_ERROR(InvalidValue) << "Too many files in a batch: "
+				 << files.size();
+  // buffers of a bigger previous batch are given back
+  m_buffers.resize(files.size());
+
+  size_t i = 0;
+#ifdef WITH_IO_URING
+  if(m_ring && !files.empty())
+    {
+      _readBatch(files,0,files.size());
+      i = files.size();
+    }
+#endif
+  for(;i < files.size();++i)
+    {
+      File& file = files[i];
+      std::vector<char>& buffer = m_buffers[i];
+      bool ok = _readFile(file.path,buffer);
+      file.data = ok ? &buffer[0] : NULL;
+      file.size = ok ? long(buffer.size()) : 0;
+    }
+}
+
+bool BatchReader::_readFile(const std::string& path,std::vector<char>& buffer)
+{
+  int fd = open(path.c_str(),O_RDONLY);
+  if(fd < 0)
+    return false;
+
+  struct stat file_stat;
+  bool ok = !fstat(fd,&file_stat) && file_stat.st_size > 0;
+  if(ok)
+    {
+      buffer.resize(file_stat.st_size);
+      for(long offset = 0;ok && offset < file_stat.st_size;)
+	{
+	  ssize_t nb_read = pread(fd,&buffer[offset],
+				  file_stat.st_size - offset,offset);
+	  if(nb_read < 0 && errno == EINTR)
+	    continue;
+	  ok = nb_read > 0;
+	  offset += nb_read;
+	}
+    }
+  close(fd);
+  return ok;
+}
+
+#ifdef WITH_IO_URING
+//-----------------------------------------------------
+// three submissions per batch: open+statx, read, close.
+// Files failing with io_uring are read again synchronously.
+//-----------------------------------------------------
+void BatchReader::_readBatch(std::vector<File>& files,size_t first,
+			     size_t nb_files)
+{
+  struct io_uring* ring = (struct io_uring*)m_ring;
+  std::vector<int> fds(nb_files,-1);
+  std::vector<struct statx> stats(nb_files);
+  std::vector<bool> ok(nb_files,true);
+  bool aNotSupported = false;
+
+  for(size_t i = 0;i < nb_files;++i)
+    {
+      const char* path = files[first + i].path.c_str();
+      struct io_uring_sqe* sqe = io_uring_get_sqe(ring);
+      io_uring_prep_openat(sqe,AT_FDCWD,path,O_RDONLY,0);
+      io_uring_sqe_set_data(sqe,(void*)(2 * i));
+      sqe = io_uring_get_sqe(ring);
+      io_uring_prep_statx(sqe,AT_FDCWD,path,0,STATX_SIZE,&stats[i]);
+      io_uring_sqe_set_data(sqe,(void*)(2 * i + 1));
+    }
+  io_uring_submit(ring);
+  for(size_t n = 0;n < 2 * nb_files;++n)
+    {
+      struct io_uring_cqe* cqe;
+      if(io_uring_wait_cqe(ring,&cqe))
+	break;
+      size_t user_data = (size_t)io_uring_cqe_get_data(cqe);
+      size_t i = user_data / 2;
+      if(cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+	aNotSupported = true;
+      if(cqe->res < 0)
+	ok[i] = false;
+      else if(!(user_data & 1))
+	fds[i] = cqe->res;
+      io_uring_cqe_seen(ring,cqe);
+    }
+
+  int nb_reads = 0;
+  for(size_t i = 0;i < nb_files;++i)
+    {
+      if(!ok[i] || fds[i] < 0 || !stats[i].stx_size)
+	{
+	  ok[i] = false;
+	  continue;
+	}
+      std::vector<char>& buffer = m_buffers[first + i];
+      buffer.resize(stats[i].stx_size);
+      struct io_uring_sqe* sqe = io_uring_get_sqe(ring);
+      io_uring_prep_read(sqe,fds[i],&buffer[0],buffer.size(),0);
+      io_uring_sqe_set_data(sqe,(void*)i);
+      ++nb_reads;
+    }
+  io_uring_submit(ring);
+  for(int n = 0;n < nb_reads;++n)
+    {
+      struct io_uring_cqe* cqe;
+      if(io_uring_wait_cqe(ring,&cqe))
+	break;
+      size_t i = (size_t)io_uring_cqe_get_data(cqe);
+      if(cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+	aNotSupported = true;
+      ok[i] = cqe->res == long(m_buffers[first + i].size());
+      io_uring_cqe_seen(ring,cqe);
+    }
+
+  int nb_closes = 0;
+  for(size_t i = 0;i < nb_files;++i)
+    if(fds[i] >= 0)
+      {
+	struct io_uring_sqe* sqe = io_uring_get_sqe(ring);
+	io_uring_prep_close(sqe,fds[i]);
+	io_uring_sqe_set_data(sqe,(void*)i);
+	++nb_closes;
+      }
+  io_uring_submit(ring);
+  for(int n = 0;n < nb_closes;++n)
+    {
+      struct io_uring_cqe* cqe;
+      if(io_uring_wait_cqe(ring,&cqe))
+	break;
+      if(cqe->res == -EINVAL)
+	close(fds[(size_t)io_uring_cqe_get_data(cqe)]);
+      io_uring_cqe_seen(ring,cqe);
+    }
+
+  for(size_t i = 0;i < nb_files;++i)
+    {
+      File& file = files[first + i];
+      std::vector<char>& buffer = m_buffers[first + i];
+      if(!ok[i])		// short read, missing file or old kernel
+	ok[i] = _readFile(file.path,buffer);
+      file.data = ok[i] ? &buffer[0] : NULL;
+      file.size = ok[i] ? long(buffer.size()) : 0;
+    }
+
+  if(aNotSupported)
+    {
+      io_uring_queue_exit(ring);
+      delete ring;
+      m_ring = NULL;
+    }
+}
+#endif
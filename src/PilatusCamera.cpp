@@ -36,6 +36,8 @@
 #include <netdb.h>
 
 #include <poll.h>
+#include <sched.h>
+#include <time.h>
 
 #include "Exceptions.h"
 
@@ -77,7 +79,7 @@ static inline const char* _get_ip_addresse(const char *name_ip)
 	m_state != Camera::ERROR &&				    \
 	m_state != Camera::DISCONNECTED)			    \
 {                                                                   \
-  if(!m_cond.wait(TIME_OUT))                                        \
+  if(!_wait(TIME_OUT))                                              \
     THROW_HW_ERROR(lima::Error) << errmsg;                          \
 }
 
@@ -100,6 +102,19 @@ inline void _split(const std::string inString,
     returnVector.push_back (inString.substr (start));
 }
 
+//-----------------------------------------------------
+// publish the parameters when leaving a setter,
+// before its lock is released
+//-----------------------------------------------------
+class Camera::_Publisher
+{
+public:
+    _Publisher(Camera& cam) : m_cam(cam) {}
+    ~_Publisher() {m_cam._publish();}
+private:
+    Camera& m_cam;
+};
+
 //-----------------------------------------------------
 //
 //-----------------------------------------------------
@@ -108,17 +123,24 @@ Camera::Camera(const char *host,int port)
                     m_stop(false),
                     m_thread_id(0),
                     m_state(DISCONNECTED),
+                    m_gap_fill(false),
                     m_nb_acquired_images(0),
 		    m_has_cmd_setenergy(true),
 		    m_pilatus3_threshold_mode(false),
 		    m_major_version(-1),
 		    m_minor_version(-1),
-		    m_patch_version(-1)
+		    m_patch_version(-1),
+		    m_continuous(false),
+		    m_file_ring_size(DEFAULT_FILE_RING_SIZE),
+		    m_sequence_first_image(0),
+		    m_replaying(false),
+		    m_parameters_seq(0)
 {
     DEB_CONSTRUCTOR();
     m_server_ip         = host;
     m_server_port       = port;
     _initVariable();
+    _publish();
 
     if(pipe(m_pipes))
         THROW_HW_ERROR(Error) << "Can't open pipe";
@@ -223,6 +245,7 @@ void Camera::connect(const char *host,int port)
 {
   DEB_MEMBER_FUNCT();
   AutoMutex aLock(m_cond.mutex());
+  _Publisher publish(*this);
   _initVariable();
   _connect(host,port);
 }
@@ -327,9 +350,11 @@ void Camera::send(const std::string& message)
     DEB_TRACE() << DEB_VAR1(message);
     std::string msg = message;
     msg+= SOCKET_SEPARATOR;
-    if(write(m_socket,msg.c_str(),msg.size()) == -1)
+    // commands of a replayed session are not sent
+    if(!m_replaying && write(m_socket,msg.c_str(),msg.size()) == -1)
       THROW_HW_ERROR(Error) << "Could not send message to camserver";
-
+    m_protocol_log.record(ProtocolLog::SENT,m_state,
+			  message.data(),message.size());
 }
 
 //-----------------------------------------------------
@@ -433,199 +458,233 @@ void Camera::_run()
                 DEB_TRACE() <<"-- no message received";
                 close(m_socket);
                 m_socket = -1;
-                m_state = Camera::DISCONNECTED;                
+                m_state = Camera::DISCONNECTED;
+                m_protocol_log.record(ProtocolLog::DISCONNECTED,m_state,NULL,0);
             }
             else
-            {                
-                if(m_state == Camera::ERROR)//nothing to do, keep last error until a new explicit user command (start, stop, setenergy, ...)
-                  continue;
-                std::string strMessages(messages,aMessageSize );                    
-                DEB_TRACE() << DEB_VAR1(strMessages);
-                std::vector<std::string> msg_vector;
-                _split(strMessages,SPLIT_SEPARATOR,msg_vector);
-                for(std::vector<std::string>::iterator msg_iterator = msg_vector.begin();
-		    msg_iterator != msg_vector.end();++msg_iterator)
-                {
-                    std::string &msg = *msg_iterator;
+            {
+                m_protocol_log.record(ProtocolLog::RECEIVED,m_state,
+				      messages,aMessageSize);
+                _parse(std::string(messages,aMessageSize));
+                m_protocol_log.record(ProtocolLog::STATUS,m_state,NULL,0);
+            }
+        }
+        _publish();
+    }
+}
+//-----------------------------------------------------
+// handle a chunk of camserver replies, lock must be held
+//-----------------------------------------------------
+void Camera::_parse(const std::string& strMessages)
+{
+    DEB_MEMBER_FUNCT();
+
+    if(m_state == Camera::ERROR)//nothing to do, keep last error until a new explicit user command (start, stop, setenergy, ...)
+      return;
+    DEB_TRACE() << DEB_VAR1(strMessages);
+    std::vector<std::string> msg_vector;
+    _split(strMessages,SPLIT_SEPARATOR,msg_vector);
+    for(std::vector<std::string>::iterator msg_iterator = msg_vector.begin();
+	msg_iterator != msg_vector.end();++msg_iterator)
+    {
+        std::string &msg = *msg_iterator;
 
-                    if(msg.substr(0,2) == "15") // generic response
+        if(msg.substr(0,2) == "15") // generic response
+        {
+            if(msg.substr(3,2) == "OK") // will check what the message is about
+            {                            
+                std::string real_message = msg.substr(6);
+		size_t position;
+                if(real_message.find("Energy") != std::string::npos)
+		{
+		  size_t columnPos = real_message.find(":");
+		  if(columnPos == std::string::npos)
+		    {
+		      m_threshold = m_energy = -1;
+		      m_gain = DEFAULT_GAIN;
+		    }
+		  else
+		    m_energy = atoi(real_message.substr(columnPos + 1).c_str());
+		}
+                if((position = real_message.find("Settings:")) !=
+		   std::string::npos) // Threshold and gain is already set,read them
+                {
+		    std::string submsg = real_message.substr(position);
+                    std::vector<std::string> threshold_vector;
+                    _split(submsg.substr(10),";",threshold_vector);
+                    std::string &gain_string = threshold_vector[0];
+                    std::string &threshold_string = threshold_vector[1];
+                    std::vector<std::string> thr_val;
+                    _split(threshold_string," ",thr_val);
+                    std::string &threshold_value = thr_val[2];
+                    m_threshold = atoi(threshold_value.c_str());
+
+                    std::vector<std::string> gain_split;
+                    _split(gain_string," ",gain_split);
+                    std::string &gain_value = gain_split[0];
+                    std::map<std::string,Gain>::iterator gFind = GAIN_SERVER_RESPONSE.find(gain_value);
+                    m_gain = gFind->second;
+                    m_state = Camera::STANDBY;                               
+                }
+                else if(real_message.find("/tmp/setthreshold")!=std::string::npos)
+                {
+                    if(m_state == Camera::SETTING_THRESHOLD)
                     {
-                        if(msg.substr(3,2) == "OK") // will check what the message is about
-                        {                            
-                            std::string real_message = msg.substr(6);
-			    size_t position;
-                            if(real_message.find("Energy") != std::string::npos)
-			    {
-			      size_t columnPos = real_message.find(":");
-			      if(columnPos == std::string::npos)
-				{
-				  m_threshold = m_energy = -1;
-				  m_gain = DEFAULT_GAIN;
-				}
-			      else
-				m_energy = atoi(real_message.substr(columnPos + 1).c_str());
-			    }
-                            if((position = real_message.find("Settings:")) !=
-			       std::string::npos) // Threshold and gain is already set,read them
-                            {
-			        std::string submsg = real_message.substr(position);
-                                std::vector<std::string> threshold_vector;
-                                _split(submsg.substr(10),";",threshold_vector);
-                                std::string &gain_string = threshold_vector[0];
-                                std::string &threshold_string = threshold_vector[1];
-                                std::vector<std::string> thr_val;
-                                _split(threshold_string," ",thr_val);
-                                std::string &threshold_value = thr_val[2];
-                                m_threshold = atoi(threshold_value.c_str());
-
-                                std::vector<std::string> gain_split;
-                                _split(gain_string," ",gain_split);
-                                std::string &gain_value = gain_split[0];
-                                std::map<std::string,Gain>::iterator gFind = GAIN_SERVER_RESPONSE.find(gain_value);
-                                m_gain = gFind->second;
-                                m_state = Camera::STANDBY;                               
-                            }
-                            else if(real_message.find("/tmp/setthreshold")!=std::string::npos)
-                            {
-                                if(m_state == Camera::SETTING_THRESHOLD)
-                                {
-                                  DEB_TRACE() << "-- Threshold process succeeded";
-                                }
-                                if(m_state == Camera::SETTING_ENERGY)
-                                {
-                                  DEB_TRACE() << "-- SetEnergy process succeeded";
-                                }
-                                _reinit(); // resync with server
-                            }
-                            else if(real_message.find("Exposure")!=std::string::npos)
-                            {
-                                int columnPos = real_message.find(":");
-                                int lastSpace = real_message.rfind(" ");
-                                if(real_message.substr(9,4) == "time")
-                                {
-                                    m_exposure = atof(real_message.substr(columnPos + 1,lastSpace).c_str());
-                                }
-                                else if(real_message.substr(9,6) == "period")
-                                {
-                                    m_exposure_period = atof(real_message.substr(columnPos + 1,lastSpace).c_str());
-                                }
-                                else // Exposures per frame
-                                {
-                                    m_exposure_per_frame = atoi(real_message.substr(columnPos + 1).c_str());\
-                                }
-                            }
-                            else if(real_message.find("Delay")!=std::string::npos)
-                            {
-                                int columnPos = real_message.find(":");
-                                int lastSpace = real_message.rfind(" ");
-                                m_hardware_trigger_delay = atof(real_message.substr(columnPos + 1,lastSpace).c_str());
-                            }
-                            else if(real_message.find("N images")!=std::string::npos)
-                            {
-                                int columnPos = real_message.find(":");
-                                m_nimages = atoi(real_message.substr(columnPos+1).c_str());
-                            }
-			    if(m_state != Camera::RUNNING)
-			      m_state = Camera::STANDBY;
-                        }
-                        else  // ERROR MESSAGE
-                        {
-			  m_error_message = msg.substr(7);
-                            if(m_state == Camera::SETTING_THRESHOLD)
-			      DEB_TRACE() << "-- Threshold process failed";
-                            if(m_state == Camera::SETTING_ENERGY)
-			      DEB_TRACE() << "-- SetEnergy process failed";
-                            else if(m_state == Camera::RUNNING)
-			      DEB_TRACE() << "-- Exposure process failed";
-                            else
-			      DEB_TRACE() << "-- ERROR " << m_error_message;
-
-			    m_state = Camera::ERROR;
-			}
-                        m_cond.broadcast();
+                      DEB_TRACE() << "-- Threshold process succeeded";
                     }
-                    else if(msg.substr(0,2) == "13") //Acquisition Killed
+                    if(m_state == Camera::SETTING_ENERGY)
                     {
-                        DEB_TRACE() << "-- Acquisition Killed"; 
-                        m_state = Camera::STANDBY;
+                      DEB_TRACE() << "-- SetEnergy process succeeded";
                     }
-                    else if(msg.substr(0,2) == "7 ")
+                    _reinit(); // resync with server
+                }
+                else if(real_message.find("Exposure")!=std::string::npos)
+                {
+                    int columnPos = real_message.find(":");
+                    int lastSpace = real_message.rfind(" ");
+                    if(real_message.substr(9,4) == "time")
                     {
-                        if(msg.substr(2,2) == "OK")
-                        {
-                            DEB_TRACE() << "-- Exposure succeeded";
-                            m_state = Camera::STANDBY;
-                            m_nb_acquired_images = m_nimages;
-                        }
-                        else
-                        {
-                            DEB_TRACE() << "-- ERROR";                      
-                            m_state = Camera::ERROR;
-                            msg = msg.substr(2);
-                            m_error_message = msg.substr(msg.find(" "));
-                        }
+                        m_exposure = atof(real_message.substr(columnPos + 1,lastSpace).c_str());
                     }
-                    else if(msg.substr(0,2) == "1 ")
+                    else if(real_message.substr(9,6) == "period")
                     {
-                        if(msg.substr(2,3) == "ERR")
-                        {
-			  // Not an error just old version of camserver
-			  if(msg.find("Unrecognized command: setenergy") != 
-			     std::string::npos)
-			    {
-			      m_has_cmd_setenergy = false;
-			      _resync();
-			    }
-			  else if(msg.find("Unrecognized command: version") != 
-				  std::string::npos)
-			    {
-			      DEB_TRACE() << "Can't retrieved camserver version";
-			    }
-			  else
-			    {
-                            DEB_TRACE() << "-- ERROR";
-                            m_error_message = msg.substr(6);
-                            DEB_TRACE() << m_error_message;
-                            m_state = Camera::ERROR;
-			    }
-                        }
+                        m_exposure_period = atof(real_message.substr(columnPos + 1,lastSpace).c_str());
                     }
-                    else if(msg.substr(0,2) == "10")
+                    else // Exposures per frame
                     {
-                        if(msg.substr(3,2) == "OK")
-                        {
-                            DEB_TRACE() << "-- imgpath setting succeeded";
-                            ////m_imgpath = msg.substr(6);////@@@@
-                            m_state = Camera::STANDBY;
-                        }
-                        else
-                        {
-                            DEB_TRACE() << "-- ERROR";
-                            m_state = Camera::ERROR;
-                            msg = msg.substr(2);
-                            m_error_message = msg.substr(msg.find(" "));
-                            DEB_TRACE() << m_error_message;
-                        }                        
+                        m_exposure_per_frame = atoi(real_message.substr(columnPos + 1).c_str());\
                     }
-		    else if(msg.substr(0,2) == "24")
-		      {
-			if(msg.substr(3,2) == "OK" &&
-			   msg.substr(6,12) == "Code release")
-			  {
-			    DEB_TRACE() << msg.substr(6);
-			    std::vector<std::string> version_vector;
-			    _split(msg.substr(20),".",version_vector);
-			    if(version_vector.size() == 3)
-			      {
-				m_major_version = atoi(version_vector[0].c_str());
-				m_minor_version = atoi(version_vector[1].c_str());
-				m_patch_version = atoi(version_vector[2].c_str());
-			      }
-			  }
-		      }
                 }
+                else if(real_message.find("Delay")!=std::string::npos)
+                {
+                    int columnPos = real_message.find(":");
+                    int lastSpace = real_message.rfind(" ");
+                    m_hardware_trigger_delay = atof(real_message.substr(columnPos + 1,lastSpace).c_str());
+                }
+                else if(real_message.find("N images")!=std::string::npos)
+                {
+                    int columnPos = real_message.find(":");
+                    m_nimages = atoi(real_message.substr(columnPos+1).c_str());
+                }
+		if(m_state != Camera::RUNNING)
+		  m_state = Camera::STANDBY;
+            }
+            else  // ERROR MESSAGE
+            {
+	      m_error_message = msg.substr(7);
+                if(m_state == Camera::SETTING_THRESHOLD)
+		  DEB_TRACE() << "-- Threshold process failed";
+                if(m_state == Camera::SETTING_ENERGY)
+		  DEB_TRACE() << "-- SetEnergy process failed";
+                else if(m_state == Camera::RUNNING)
+		  DEB_TRACE() << "-- Exposure process failed";
+                else
+		  DEB_TRACE() << "-- ERROR " << m_error_message;
+
+		m_state = Camera::ERROR;
+	    }
+            m_cond.broadcast();
+        }
+        else if(msg.substr(0,2) == "13") //Acquisition Killed
+        {
+            DEB_TRACE() << "-- Acquisition Killed"; 
+            m_state = Camera::STANDBY;
+        }
+        else if(msg.substr(0,2) == "7 ")
+        {
+            if(msg.substr(2,2) == "OK" &&
+	       m_continuous && m_state == Camera::RUNNING)
+            {
+		// next sequence, file names wrap on the ring
+                DEB_TRACE() << "-- Sequence succeeded";
+                m_nb_acquired_images += m_nimages;
+		m_sequence_first_image = (m_sequence_first_image + m_nimages) %
+		  m_file_ring_size;
+		try
+		  {
+		    _startSequence(m_sequence_first_image);
+		  }
+		catch(Exception& e)
+		  {
+		    // reported by status(), the camera thread keeps running
+		    DEB_ERROR() << "Can't restart sequence: " << e.getErrMsg();
+		    m_error_message = "Can't restart sequence: " + e.getErrMsg();
+		    m_state = Camera::ERROR;
+		    m_cond.broadcast();
+		  }
+            }
+            else if(msg.substr(2,2) == "OK")
+            {
+                DEB_TRACE() << "-- Exposure succeeded";
+                m_state = Camera::STANDBY;
+                m_nb_acquired_images += m_nimages;
+            }
+            else
+            {
+                DEB_TRACE() << "-- ERROR";                      
+                m_state = Camera::ERROR;
+                msg = msg.substr(2);
+                m_error_message = msg.substr(msg.find(" "));
+            }
+        }
+        else if(msg.substr(0,2) == "1 ")
+        {
+            if(msg.substr(2,3) == "ERR")
+            {
+	      // Not an error just old version of camserver
+	      if(msg.find("Unrecognized command: setenergy") != 
+		 std::string::npos)
+		{
+		  m_has_cmd_setenergy = false;
+		  _resync();
+		}
+	      else if(msg.find("Unrecognized command: version") != 
+		      std::string::npos)
+		{
+		  DEB_TRACE() << "Can't retrieved camserver version";
+		}
+	      else
+		{
+                DEB_TRACE() << "-- ERROR";
+                m_error_message = msg.substr(6);
+                DEB_TRACE() << m_error_message;
+                m_state = Camera::ERROR;
+		}
             }
         }
+        else if(msg.substr(0,2) == "10")
+        {
+            if(msg.substr(3,2) == "OK")
+            {
+                DEB_TRACE() << "-- imgpath setting succeeded";
+                ////m_imgpath = msg.substr(6);////@@@@
+                m_state = Camera::STANDBY;
+            }
+            else
+            {
+                DEB_TRACE() << "-- ERROR";
+                m_state = Camera::ERROR;
+                msg = msg.substr(2);
+                m_error_message = msg.substr(msg.find(" "));
+                DEB_TRACE() << m_error_message;
+            }                        
+        }
+	else if(msg.substr(0,2) == "24")
+	  {
+	    if(msg.substr(3,2) == "OK" &&
+	       msg.substr(6,12) == "Code release")
+	      {
+		DEB_TRACE() << msg.substr(6);
+		std::vector<std::string> version_vector;
+		_split(msg.substr(20),".",version_vector);
+		if(version_vector.size() == 3)
+		  {
+		    m_major_version = atoi(version_vector[0].c_str());
+		    m_minor_version = atoi(version_vector[1].c_str());
+		    m_patch_version = atoi(version_vector[2].c_str());
+		  }
+	      }
+	  }
     }
 }
 //-----------------------------------------------------
@@ -635,6 +694,7 @@ void Camera::setImgpath(const std::string& path)
 {
     DEB_MEMBER_FUNCT();
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     RECONNECT_WAIT_UNTIL(Camera::STANDBY,
 			 "Could not set imgpath, server not idle");
     m_imgpath = path;    
@@ -678,8 +738,7 @@ const std::string& Camera::fileName() const
 //-----------------------------------------------------
 Camera::Status Camera::status() const
 {
-    AutoMutex aLock(m_cond.mutex());
-    return m_state;
+    return parameters().status;
 }
 
 //-----------------------------------------------------
@@ -697,6 +756,7 @@ const std::string& Camera::errorMessage() const
 void Camera::softReset()
 {
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     m_error_message.clear();
     m_state = Camera::STANDBY;
 }
@@ -707,6 +767,7 @@ void Camera::softReset()
 void Camera::hardReset()
 {
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     send("resetcam");
 }
 
@@ -715,11 +776,7 @@ void Camera::hardReset()
 //-----------------------------------------------------
 double Camera::energy() const
 {
-    AutoMutex aLock(m_cond.mutex());
-    if(m_has_cmd_setenergy)
-       return (double)m_energy/1000;
-    else
-       return (double)m_threshold/600;
+    return parameters().energy;
 }
 
 //-----------------------------------------------------
@@ -740,6 +797,7 @@ void Camera::setEnergy(double val)
 	std::stringstream msg;
 	msg << "setenergy " << val*1000;
 	send(msg.str());
+	_publish();
       }
     else
       {
@@ -752,6 +810,7 @@ void Camera::setEnergy(double val)
         else if (val > 8 && val <= 12) gain = MID;
         else if (val >= 6 && val <= 8) gain = HIGH;
         else gain = UHIGH;
+        _publish();
         aLock.unlock();
         setThresholdGain(threshold, gain);
       }
@@ -763,8 +822,7 @@ void Camera::setEnergy(double val)
 //-----------------------------------------------------
 int Camera::threshold() const
 {
-    AutoMutex aLock(m_cond.mutex());
-    return m_threshold;
+    return parameters().threshold;
 }
 
 //-----------------------------------------------------
@@ -772,8 +830,7 @@ int Camera::threshold() const
 //-----------------------------------------------------
 Camera::Gain Camera::gain() const
 {
-    AutoMutex aLock(m_cond.mutex());
-    return m_gain;
+    return parameters().gain;
 }
 
 //-----------------------------------------------------
@@ -784,6 +841,7 @@ void Camera::setThresholdGain(int value,Camera::Gain gain)
     DEB_MEMBER_FUNCT();
 
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     RECONNECT_WAIT_UNTIL(Camera::STANDBY,
 			 "Could not set threshold, server is not idle");
     m_state = Camera::SETTING_THRESHOLD;    
@@ -819,6 +877,7 @@ void Camera::setThreshold(int threshold,int energy)
     THROW_HW_ERROR(NotSupported) << "Could not use pilatus threshold flavor";
 
   AutoMutex aLock(m_cond.mutex());
+  _Publisher publish(*this);
   RECONNECT_WAIT_UNTIL(Camera::STANDBY,
 		       "Could not set threshold,server is not idle");
 
@@ -843,8 +902,7 @@ void Camera::setThreshold(int threshold,int energy)
 //-----------------------------------------------------
 double Camera::exposure() const
 {
-    AutoMutex aLock(m_cond.mutex());
-    return m_exposure;
+    return parameters().exposure;
 }
 
 //-----------------------------------------------------
@@ -854,6 +912,7 @@ void Camera::setExposure(double val)
 {
     DEB_MEMBER_FUNCT();
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     // yet an other border-effect with the SPEC CCD interface
     // to reach the GATE mode SPEC programs extgate + expotime = 0
     if(m_trigger_mode == Camera::EXTERNAL_GATE and val <= 0)
@@ -872,8 +931,7 @@ void Camera::setExposure(double val)
 //-----------------------------------------------------
 double Camera::exposurePeriod() const
 {
-    AutoMutex aLock(m_cond.mutex());
-    return m_exposure_period;
+    return parameters().exposure_period;
 }
 
 //-----------------------------------------------------
@@ -883,6 +941,7 @@ void Camera::setExposurePeriod(double val)
 {
     DEB_MEMBER_FUNCT();
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     RECONNECT_WAIT_UNTIL(Camera::STANDBY,
 			 "Could not set exposure period, server not idle");
     m_state = Camera::SETTING_EXPOSURE_PERIOD;
@@ -891,7 +950,7 @@ void Camera::setExposurePeriod(double val)
     send(msg.str());
     // Exposure period can failed if it's two fast
     while(m_state == Camera::SETTING_EXPOSURE_PERIOD)
-      m_cond.wait(TIME_OUT);
+      _wait(TIME_OUT);
     if(m_state == Camera::ERROR)
       {
 	m_state = Camera::STANDBY;
@@ -905,8 +964,7 @@ void Camera::setExposurePeriod(double val)
 //-----------------------------------------------------
 int Camera::nbImagesInSequence() const
 {
-    AutoMutex aLock(m_cond.mutex());
-    return m_nimages;
+    return parameters().nb_images_in_sequence;
 }
 
 //-----------------------------------------------------
@@ -916,6 +974,7 @@ void Camera::setNbImagesInSequence(int nb)
 {
     DEB_MEMBER_FUNCT();
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     RECONNECT_WAIT_UNTIL(Camera::STANDBY,
 			 "Could not set number image in sequence, server not idle");
     m_state = Camera::SETTING_NB_IMAGE_IN_SEQUENCE;
@@ -929,8 +988,7 @@ void Camera::setNbImagesInSequence(int nb)
 //-----------------------------------------------------
 double Camera::hardwareTriggerDelay() const
 {
-    AutoMutex aLock(m_cond.mutex());
-    return m_hardware_trigger_delay;
+    return parameters().hardware_trigger_delay;
 }
 
 //-----------------------------------------------------
@@ -940,6 +998,7 @@ void Camera::setHardwareTriggerDelay(double value)
 {
     DEB_MEMBER_FUNCT();
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     RECONNECT_WAIT_UNTIL(Camera::STANDBY,
 			 "Could not set hardware trigger delay, server not idle");
     m_state = Camera::SETTING_HARDWARE_TRIGGER_DELAY;
@@ -953,8 +1012,7 @@ void Camera::setHardwareTriggerDelay(double value)
 //-----------------------------------------------------
 int Camera::nbExposurePerFrame() const
 {
-    AutoMutex aLock(m_cond.mutex());
-    return m_exposure_per_frame;
+    return parameters().nb_exposure_per_frame;
 }
 
 //-----------------------------------------------------
@@ -964,6 +1022,7 @@ void Camera::setNbExposurePerFrame(int val)
 {
     DEB_MEMBER_FUNCT();
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     RECONNECT_WAIT_UNTIL(Camera::STANDBY,
 			 "Could not set exposure per frame, server not idle");
     m_state = Camera::SETTING_EXPOSURE_PER_FRAME;
@@ -977,8 +1036,7 @@ void Camera::setNbExposurePerFrame(int val)
 //-----------------------------------------------------
 Camera::TriggerMode Camera::triggerMode() const
 {
-    AutoMutex aLock(m_cond.mutex());
-    return m_trigger_mode;
+    return parameters().trigger_mode;
 }
 
 //-----------------------------------------------------
@@ -993,6 +1051,7 @@ Camera::TriggerMode Camera::triggerMode() const
 void Camera::setTriggerMode(Camera::TriggerMode triggerMode)
 {
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     m_trigger_mode = triggerMode;
 }
 
@@ -1004,18 +1063,36 @@ void Camera::startAcquisition(int image_number)
 {
     DEB_MEMBER_FUNCT();
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     m_nb_acquired_images = 0;
     if(m_state == Camera::RUNNING)
         THROW_HW_ERROR(Error) << "Could not start acquisition, you have to wait the end of the previous one";
 
-    char filename[256];
-    snprintf(filename,sizeof(filename),m_file_pattern.c_str(),image_number);
-
     //Start Acquisition
  
     RECONNECT_WAIT_UNTIL(Camera::STANDBY,
 			 "Could not start Acquisition, server not idle");    
     m_state = Camera::RUNNING;
+    m_sequence_first_image = image_number;
+    _startSequence(image_number);
+    if(m_trigger_mode != Camera::INTERNAL_SINGLE || 
+       m_trigger_mode != Camera::INTERNAL_MULTI)
+      {
+        _wait(TIME_OUT);
+	if(m_pilatus3_threshold_mode)
+	  _wait(1.);	// Ugly fix for external synchro
+      }
+
+}
+
+//-----------------------------------------------------
+// send the start command of a sequence, lock must be held
+//-----------------------------------------------------
+void Camera::_startSequence(int image_number)
+{
+    char filename[256];
+    snprintf(filename,sizeof(filename),m_file_pattern.c_str(),image_number);
+
     std::stringstream msg;
 
     if(m_trigger_mode == Camera::EXTERNAL_SINGLE)
@@ -1028,14 +1105,61 @@ void Camera::startAcquisition(int image_number)
       msg << "exposure " << filename;
 
     send(msg.str());
-    if(m_trigger_mode != Camera::INTERNAL_SINGLE || 
-       m_trigger_mode != Camera::INTERNAL_MULTI)
-      {
-        m_cond.wait(TIME_OUT);
-	if(m_pilatus3_threshold_mode)
-	  m_cond.wait(1.);	// Ugly fix for external synchro
-      }
+}
 
+//-----------------------------------------------------
+// continuous: sequences are restarted by the camera thread
+// as soon as camserver ends one, until stopAcquisition
+//-----------------------------------------------------
+void Camera::setContinuous(bool flag)
+{
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(flag);
+    AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
+    m_continuous = flag;
+}
+
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+bool Camera::continuous() const
+{
+    return parameters().continuous;
+}
+
+//-----------------------------------------------------
+// number of file names used in continuous, indices wrap
+//-----------------------------------------------------
+void Camera::setFileRingSize(int nb_files)
+{
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(nb_files);
+    if(nb_files < MIN_FILE_RING_SIZE || nb_files > MAX_FILE_RING_SIZE ||
+       nb_files % 2)
+      THROW_HW_ERROR(InvalidValue) << "Invalid file ring size: "
+				   << DEB_VAR3(nb_files,MIN_FILE_RING_SIZE,
+					       MAX_FILE_RING_SIZE);
+    AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
+    m_file_ring_size = nb_files;
+}
+
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+int Camera::fileRingSize() const
+{
+    return parameters().file_ring_size;
+}
+
+//-----------------------------------------------------
+// half a ring: a new sequence never overwrites the files
+// of the previous one
+//-----------------------------------------------------
+int Camera::continuousSequenceSize() const
+{
+    return parameters().file_ring_size / 2;
 }
 
 //-----------------------------------------------------
@@ -1044,6 +1168,7 @@ void Camera::startAcquisition(int image_number)
 void Camera::stopAcquisition()
 {
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     if(m_state == Camera::RUNNING)
     {
         m_state = Camera::KILL_ACQUISITION;
@@ -1054,6 +1179,8 @@ void Camera::stopAcquisition()
 void Camera::errorStopAcquisition()
 {
   stopAcquisition();
+  AutoMutex aLock(m_cond.mutex());
+  _Publisher publish(*this);
   m_state = Camera::ERROR;
 }
 //-----------------------------------------------------
@@ -1063,6 +1190,7 @@ void Camera::setGapfill(bool val)
 {
     DEB_MEMBER_FUNCT();
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     RECONNECT_WAIT_UNTIL(Camera::STANDBY,
 			 "Could not set gap, server not idle");
     m_gap_fill = val;
@@ -1076,8 +1204,7 @@ void Camera::setGapfill(bool val)
 //-----------------------------------------------------
 bool Camera::gapfill() const
 {
-    AutoMutex aLock(m_cond.mutex());
-    return m_gap_fill;
+    return parameters().gapfill;
 }
 
 //-----------------------------------------------------
@@ -1088,6 +1215,7 @@ void Camera::sendAnyCommand(const std::string& message)
     DEB_MEMBER_FUNCT();
 
     AutoMutex aLock(m_cond.mutex());
+    _Publisher publish(*this);
     RECONNECT_WAIT_UNTIL(Camera::STANDBY,
 			 "Could not send the Command, server is not idle");
 
@@ -1099,6 +1227,7 @@ std::string Camera::sendAnyCommandAndGetErrorMsg(const std::string& message)
   DEB_MEMBER_FUNCT();
 
   AutoMutex aLock(m_cond.mutex());
+  _Publisher publish(*this);
   RECONNECT_WAIT_UNTIL(Camera::STANDBY,
 		       "Could not send the Command, server is not idle");
 
@@ -1109,7 +1238,7 @@ std::string Camera::sendAnyCommandAndGetErrorMsg(const std::string& message)
 	m_state != Camera::ERROR &&
 	m_state != Camera::DISCONNECTED)
     {
-      if(!m_cond.wait(TIME_OUT))
+      if(!_wait(TIME_OUT))
 	return "Timeout";
     }
 
@@ -1124,20 +1253,196 @@ std::string Camera::sendAnyCommandAndGetErrorMsg(const std::string& message)
 //
 //-----------------------------------------------------
 int Camera::nbAcquiredImages() const
+{
+    return parameters().nb_acquired_images;
+}
+//-----------------------------------------------------
+// all the parameters at once, without taking the lock:
+// retried while the camera thread publishes new ones
+//-----------------------------------------------------
+Camera::Parameters Camera::parameters() const
+{
+    Parameters params;
+    unsigned int seq;
+    do
+    {
+        while((seq = m_parameters_seq) & 1)
+          sched_yield();
+        __sync_synchronize();
+        params = m_parameters;
+        __sync_synchronize();
+    }
+    while(seq != m_parameters_seq);
+    return params;
+}
+
+//-----------------------------------------------------
+// copy the cache variables for the readers (seqlock),
+// lock must be held so there is only one writer
+//-----------------------------------------------------
+void Camera::_publish()
+{
+    __sync_fetch_and_add(&m_parameters_seq,1);
+    m_parameters.status = m_state;
+    m_parameters.energy = m_has_cmd_setenergy ?
+      (double)m_energy/1000 : (double)m_threshold/600;
+    m_parameters.threshold = m_threshold;
+    m_parameters.gain = m_gain;
+    m_parameters.exposure = m_exposure;
+    m_parameters.exposure_period = m_exposure_period;
+    m_parameters.nb_images_in_sequence = m_nimages;
+    m_parameters.hardware_trigger_delay = m_hardware_trigger_delay;
+    m_parameters.nb_exposure_per_frame = m_exposure_per_frame;
+    m_parameters.trigger_mode = m_trigger_mode;
+    m_parameters.gapfill = m_gap_fill;
+    m_parameters.continuous = m_continuous;
+    m_parameters.file_ring_size = m_file_ring_size;
+    m_parameters.nb_acquired_images = m_nb_acquired_images;
+    m_parameters.major_version = m_major_version;
+    m_parameters.minor_version = m_minor_version;
+    m_parameters.patch_version = m_patch_version;
+    __sync_fetch_and_add(&m_parameters_seq,1);
+}
+
+//-----------------------------------------------------
+// waiting for camserver, readers see the state set so far
+//-----------------------------------------------------
+bool Camera::_wait(double timeout)
+{
+    _publish();
+    return m_cond.wait(timeout);
+}
+
+//-----------------------------------------------------
+// record the camserver session in a binary log
+//-----------------------------------------------------
+void Camera::startRecording(const std::string& path)
+{
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(path);
+    m_protocol_log.open(path);
+}
+
+void Camera::stopRecording()
+{
+    DEB_MEMBER_FUNCT();
+    m_protocol_log.close();
+}
+
+bool Camera::recording() const
+{
+    return m_protocol_log.isOpen();
+}
+//-----------------------------------------------------
+// feed a recorded session to the reply parser, in real
+// time or as fast as possible. The camera must not be
+// connected (created with port 0), the commands are not
+// sent and the status recorded with them is restored.
+//-----------------------------------------------------
+void Camera::replay(const std::string& path,bool max_speed,
+		    Camera::ReplayStats& stats)
 {
     DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR2(path,max_speed);
+
+    ProtocolLog::Reader reader(path);
 
     AutoMutex aLock(m_cond.mutex());
-    return m_nb_acquired_images;
+    if(m_socket >= 0)
+      THROW_HW_ERROR(Error) << "Can't replay a session, camera is connected";
+
+    stats = ReplayStats();
+    _initVariable();
+    m_state = Camera::STANDBY;
+    m_replaying = true;
+
+    double start = _now();
+    try
+      {
+	ProtocolLog::Record record;
+	while(reader.next(record))
+	  {
+	    if(!max_speed)
+	      {
+		double delay = record.timestamp * 1e-9 - (_now() - start);
+		if(delay > 0)
+		  {
+		    _publish();
+		    aLock.unlock();
+		    struct timespec sleep_time;
+		    sleep_time.tv_sec = time_t(delay);
+		    sleep_time.tv_nsec = long((delay - sleep_time.tv_sec) * 1e9);
+		    nanosleep(&sleep_time,NULL);
+		    aLock.lock();
+		  }
+	      }
+
+	    ++stats.nb_records;
+	    switch(record.type)
+	      {
+	      case ProtocolLog::SENT:
+		++stats.nb_sent;
+		if(record.status == Camera::RUNNING && m_state != Camera::RUNNING)
+		  m_nb_acquired_images = 0; // as startAcquisition
+		m_state = Status(record.status);
+		break;
+	      case ProtocolLog::RECEIVED:
+		{
+		  ++stats.nb_received;
+		  stats.nb_bytes += record.data.size();
+		  double parse_start = _now();
+		  _parse(record.data);
+		  double parse_time = _now() - parse_start;
+		  stats.parse_time += parse_time;
+		  if(parse_time > stats.max_parse_time)
+		    stats.max_parse_time = parse_time;
+		}
+		break;
+	      case ProtocolLog::STATUS:
+		// status after the parsing of the received chunk
+		if(m_state != Status(record.status))
+		  {
+		    DEB_WARNING() << "Status mismatch after record "
+				  << stats.nb_records << ": "
+				  << DEB_VAR2(m_state,record.status);
+		    ++stats.nb_mismatches;
+		  }
+		break;
+	      default:
+		m_state = Camera::DISCONNECTED;
+		break;
+	      }
+	    m_cond.broadcast();
+	  }
+      }
+    catch(...)
+      {
+	m_replaying = false;
+	_publish();
+	throw;
+      }
+    m_replaying = false;
+    _publish();
+    stats.duration = _now() - start;
+    DEB_TRACE() << DEB_VAR4(stats.nb_records,stats.nb_bytes,
+			    stats.parse_time,stats.nb_mismatches);
+}
+
+double Camera::_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
 }
 //-----------------------------------------------------
 //
 //-----------------------------------------------------
 void Camera::version(int& major,int& minor,int& patch) const
 {
-  major = m_major_version;
-  minor = m_minor_version;
-  patch = m_patch_version;
+  Parameters params = parameters();
+  major = params.major_version;
+  minor = params.minor_version;
+  patch = params.patch_version;
 }
 
 //-----------------------------------------------------
@@ -0,0 +1,421 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <vector>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "Exceptions.h"
+#include "PilatusCorrection.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+static const float MAX_CORRECTED_VALUE = 2147483520.f; // max float < 2^31
+static const int COUNTER_MAX = (1 << 20) - 1;		// 20-bit counters
+static const int MIN_LUT_SIZE = 1 << 16;
+
+//-----------------------------------------------------
+// invert measured = true * exp(-true * k), k = tau / exposure
+// with Newton iterations. Above the model maximum
+// (measured * k >= 1/e), true counts are saturated to 1/k.
+//-----------------------------------------------------
+static double _true_counts(double measured,double k)
+{
+  if(measured * k >= exp(-1.))
+    return 1. / k;
+
+  double counts = measured;
+  for(int i = 0;i < 32;++i)
+    {
+      double e = exp(-k * counts);
+      double step = (counts * e - measured) / (e * (1. - k * counts));
+      counts -= step;
+      if(fabs(step) <= 1e-6 * counts)
+	break;
+    }
+  return counts;
+}
+
+/*******************************************************************
+ * \brief correction kernels
+ *
+ * masked pixels are set to MASKED_VALUE, negative pixels
+ * (gap, bad) are kept as is, others are count rate corrected,
+ * multiplied by their gain and rounded to the nearest integer.
+ * They return the maximum of src, used to size the next table.
+ *******************************************************************/
+struct _Params
+{
+  const float*	table;		///< mask and gain, NULL if not used
+  const float*	lut;		///< count rate, NULL if not used
+  int		lut_size;
+  double	k;		///< tau / exposure
+};
+
+static int _apply_scalar(int* dst,const int* src,const _Params& params,
+			 int nb_pixels)
+{
+  int max_value = 0;
+  for(int i = 0;i < nb_pixels;++i)
+    {
+      float gain = params.table ? params.table[i] : 1.f;
+      int value = src[i];
+      if(value > max_value)
+	max_value = value;
+      if(gain < 0.f)
+	dst[i] = Correction::MASKED_VALUE;
+      else if(value < 0)
+	dst[i] = value;
+      else
+	{
+	  float corrected = float(value);
+	  if(params.lut)
+	    corrected = value < params.lut_size ? params.lut[value] :
+	      float(_true_counts(value,params.k));
+	  corrected *= gain;
+	  if(corrected > MAX_CORRECTED_VALUE)
+	    corrected = MAX_CORRECTED_VALUE;
+	  dst[i] = int(lrintf(corrected));
+	}
+    }
+  return max_value;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static int _apply_avx2(int* dst,const int* src,const _Params& params,
+		       int nb_pixels)
+{
+  const __m256 zero_ps = _mm256_setzero_ps();
+  const __m256 max_value = _mm256_set1_ps(MAX_CORRECTED_VALUE);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i masked_value = _mm256_set1_epi32(Correction::MASKED_VALUE);
+  const __m256i lut_last = _mm256_set1_epi32(params.lut_size - 1);
+  __m256i max_values = zero;
+  int i = 0;
+  for(;i + 8 <= nb_pixels;i += 8)
+    {
+      __m256i value = _mm256_loadu_si256((const __m256i*)(src + i));
+      max_values = _mm256_max_epi32(max_values,value);
+      __m256 corrected;
+      if(params.lut)
+	{
+	  // above the table, pixels are done by the scalar kernel
+	  __m256i over = _mm256_cmpgt_epi32(value,lut_last);
+	  if(_mm256_movemask_epi8(over))
+	    {
+	      _Params lanes = params;
+	      if(lanes.table)
+		lanes.table += i;
+	      _apply_scalar(dst + i,src + i,lanes,8);
+	      continue;
+	    }
+	  __m256i index = _mm256_max_epi32(value,zero);
+	  corrected = _mm256_i32gather_ps(params.lut,index,4);
+	}
+      else
+	corrected = _mm256_cvtepi32_ps(value);
+
+      __m256i masked = zero;
+      if(params.table)
+	{
+	  __m256 gain = _mm256_loadu_ps(params.table + i);
+	  corrected = _mm256_mul_ps(corrected,gain);
+	  masked = _mm256_castps_si256(_mm256_cmp_ps(gain,zero_ps,_CMP_LT_OQ));
+	}
+      __m256i result = _mm256_cvtps_epi32(_mm256_min_ps(corrected,max_value));
+      __m256i negative = _mm256_cmpgt_epi32(zero,value);
+      result = _mm256_blendv_epi8(result,value,negative);
+      result = _mm256_blendv_epi8(result,masked_value,masked);
+      _mm256_storeu_si256((__m256i*)(dst + i),result);
+    }
+  _Params tail = params;
+  if(tail.table)
+    tail.table += i;
+  int max_counts = _apply_scalar(dst + i,src + i,tail,nb_pixels - i);
+
+  int lanes[8] __attribute__((aligned(32)));
+  _mm256_store_si256((__m256i*)lanes,max_values);
+  for(int lane = 0;lane < 8;++lane)
+    max_counts = std::max(max_counts,lanes[lane]);
+  return max_counts;
+}
+
+typedef int (*_apply_func)(int*,const int*,const _Params&,int);
+static _apply_func _get_apply()
+{
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return _apply_avx2;
+  return _apply_scalar;
+}
+static const _apply_func _apply = _get_apply();
+#else
+#define _apply _apply_scalar
+#endif
+
+/*******************************************************************
+ * \brief Correction
+ *******************************************************************/
+Correction::Correction() :
+  m_mask_mtime(0),
+  m_flat_field_mtime(0),
+  m_dirty(false),
+  m_table(NULL),
+  m_count_rate_correction(false),
+  m_dead_time(0.),
+  m_lut_dirty(false),
+  m_lut_exposure(0.),
+  m_lut_k(0.),
+  m_max_counts(0)
+{
+  DEB_CONSTRUCTOR();
+}
+
+Correction::~Correction()
+{
+  DEB_DESTRUCTOR();
+  _freeTable();
+}
+
+void Correction::setDetectorSize(const Size& det_size)
+{
+  DEB_MEMBER_FUNCT();
+  m_det_size = det_size;
+  m_dirty = true;
+}
+//-----------------------------------------------------
+// empty path to remove the mask
+//-----------------------------------------------------
+void Correction::setMaskFile(const std::string& path)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(path);
+  m_mask_file = path;
+  m_dirty = true;
+}
+//-----------------------------------------------------
+// empty path to remove the flat field
+//-----------------------------------------------------
+void Correction::setFlatFieldFile(const std::string& path)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(path);
+  m_flat_field_file = path;
+  m_dirty = true;
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void Correction::setCountRateCorrection(bool flag)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(flag);
+  m_count_rate_correction = flag;
+  m_lut_dirty = true;
+}
+//-----------------------------------------------------
+// tau in second
+//-----------------------------------------------------
+void Correction::setDeadTime(double tau)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(tau);
+  if(tau < 0.)
+    THROW_HW_ERROR(InvalidValue) << "Invalid dead time: " << DEB_VAR1(tau);
+  m_dead_time = tau;
+  m_lut_dirty = true;
+}
+//-----------------------------------------------------
+// exposure is the time of one detector frame
+//-----------------------------------------------------
+void Correction::prepare(double exposure,int saturation_threshold)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(exposure,saturation_threshold);
+
+  _prepareTable();
+  if(m_count_rate_correction)
+    _prepareLut(exposure,saturation_threshold);
+  else
+    m_lut.clear();
+  m_lut_dirty = false;
+}
+//-----------------------------------------------------
+// (re)build the correction table if files changed
+//-----------------------------------------------------
+void Correction::_prepareTable()
+{
+  DEB_MEMBER_FUNCT();
+
+  if(m_mask_file.empty() && m_flat_field_file.empty())
+    {
+      _freeTable();
+      return;
+    }
+
+  struct stat mask_stat,flat_field_stat;
+  if(!m_dirty &&
+     (m_mask_file.empty() ||
+      (!stat(m_mask_file.c_str(),&mask_stat) &&
+       mask_stat.st_mtime == m_mask_mtime)) &&
+     (m_flat_field_file.empty() ||
+      (!stat(m_flat_field_file.c_str(),&flat_field_stat) &&
+       flat_field_stat.st_mtime == m_flat_field_mtime)))
+    return;
+
+  long nb_pixels = long(m_det_size.getWidth()) * m_det_size.getHeight();
+  _freeTable();
+  void* table;
+  if(posix_memalign(&table,32,nb_pixels * sizeof(float)))
+    THROW_HW_ERROR(Error) << "Can't allocate correction table";
+  m_table = (float*)table;
+
+  try
+    {
+      if(!m_flat_field_file.empty())
+	{
+	  _readFile(m_flat_field_file,m_table,nb_pixels * sizeof(float),
+		    m_flat_field_mtime);
+	  for(long i = 0;i < nb_pixels;++i)
+	    if(!(m_table[i] >= 0.f)) // negative or NaN gain
+	      m_table[i] = -1.f;
+	}
+      else
+	std::fill(m_table,m_table + nb_pixels,1.f);
+
+      if(!m_mask_file.empty())
+	{
+	  std::vector<unsigned char> mask(nb_pixels);
+	  _readFile(m_mask_file,&mask[0],nb_pixels,m_mask_mtime);
+	  for(long i = 0;i < nb_pixels;++i)
+	    if(mask[i])
+	      m_table[i] = -1.f;
+	}
+    }
+  catch(...)
+    {
+      _freeTable();
+      throw;
+    }
+  m_dirty = false;
+}
+//-----------------------------------------------------
+// table covers the counts measured in the frames corrected
+// since the last table (the saturation threshold before any
+// frame), at least MIN_LUT_SIZE, up to the model maximum and
+// the counter size. Higher counts are computed one by one.
+//-----------------------------------------------------
+void Correction::_prepareLut(double exposure,int saturation_threshold)
+{
+  DEB_MEMBER_FUNCT();
+
+  if(m_dead_time <= 0.)
+    THROW_HW_ERROR(InvalidValue) << "Count rate correction needs the dead time";
+  if(exposure <= 0.)
+    THROW_HW_ERROR(NotSupported) << "Count rate correction needs "
+				 << "a known exposure time";
+  int observed = m_max_counts;
+  int measured = observed > 0 ? observed : saturation_threshold;
+  double k = m_dead_time / exposure;
+  double max_counts = std::min(exp(-1.) / k,double(COUNTER_MAX));
+  double covered = std::max(double(measured),double(MIN_LUT_SIZE - 1));
+  int lut_size = int(std::min(covered,max_counts)) + 1;
+  if(!m_lut_dirty && !m_lut.empty() && exposure == m_lut_exposure &&
+     lut_size <= int(m_lut.size()))
+    return;
+
+  m_lut.resize(lut_size);
+  for(int counts = 0;counts < lut_size;++counts)
+    m_lut[counts] = float(_true_counts(counts,k));
+  m_lut_exposure = exposure;
+  m_lut_k = k;
+  m_max_counts = 0;
+
+  DEB_TRACE() << DEB_VAR4(exposure,m_dead_time,observed,lut_size);
+}
+//-----------------------------------------------------
+// dst and src have nb_pixels, table_offset is the
+// position of src in the raw layout
+//-----------------------------------------------------
+void Correction::apply(int* dst,const int* src,long table_offset,
+		       int nb_pixels) const
+{
+  _Params params;
+  params.table = m_table ? m_table + table_offset : NULL;
+  params.lut = m_lut.empty() ? NULL : &m_lut[0];
+  params.lut_size = int(m_lut.size());
+  params.k = m_lut.empty() ? 0. : m_lut_k;
+  int max_value = _apply(dst,src,params,nb_pixels);
+
+  // shared by the workers, written only when it grows
+  int max_counts;
+  while(max_value > (max_counts = m_max_counts) &&
+	!__sync_bool_compare_and_swap(&m_max_counts,max_counts,max_value))
+    ;
+}
+
+void Correction::_readFile(const std::string& path,void* data,long size,
+			   time_t& mtime) const
+{
+  DEB_MEMBER_FUNCT();
+
+  int fd = open(path.c_str(),O_RDONLY);
+  if(fd < 0)
+    THROW_HW_ERROR(Error) << "Can't open file:" << DEB_VAR1(path);
+
+  struct stat file_stat;
+  if(fstat(fd,&file_stat) || file_stat.st_size < size)
+    {
+      close(fd);
+      THROW_HW_ERROR(Error) << "File too small for detector size:"
+			    << DEB_VAR2(path,m_det_size);
+    }
+
+  // data are at the end of the file, header is skipped
+  off_t offset = file_stat.st_size - size;
+  char* pt = (char*)data;
+  while(size > 0)
+    {
+      ssize_t nb_read = pread(fd,pt,size,offset);
+      if(nb_read <= 0)
+	{
+	  close(fd);
+	  THROW_HW_ERROR(Error) << "Can't read file:" << DEB_VAR1(path);
+	}
+      pt += nb_read,offset += nb_read,size -= nb_read;
+    }
+  close(fd);
+  mtime = file_stat.st_mtime;
+}
+
+void Correction::_freeTable()
+{
+  free(m_table);
+  m_table = NULL;
+}
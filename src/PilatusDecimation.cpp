@@ -0,0 +1,106 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <time.h>
+#include "Exceptions.h"
+#include "PilatusDecimation.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+Decimation::Decimation() :
+  m_policy(Off),
+  m_every_nth(1),
+  m_period(0.),
+  m_nb_candidates(0),
+  m_nb_delivered(0),
+  m_next_time(0.)
+{
+}
+
+//-----------------------------------------------------
+// 1 disables the decimation
+//-----------------------------------------------------
+void Decimation::setEveryNth(int nb_frames)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(nb_frames);
+  if(nb_frames < 1)
+    THROW_HW_ERROR(InvalidValue) << "Invalid decimation: " << DEB_VAR1(nb_frames);
+  m_policy = nb_frames > 1 ? EveryNth : Off;
+  m_every_nth = nb_frames;
+}
+
+//-----------------------------------------------------
+// period in second, 0 disables the decimation
+//-----------------------------------------------------
+void Decimation::setPeriod(double period)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(period);
+  if(period < 0.)
+    THROW_HW_ERROR(InvalidValue) << "Invalid decimation period: " << DEB_VAR1(period);
+  m_policy = period > 0. ? FirstAfterPeriod : Off;
+  m_period = period;
+}
+
+void Decimation::prepare()
+{
+  m_nb_candidates = 0;
+  m_nb_delivered = 0;
+  m_next_time = 0.;
+}
+//-----------------------------------------------------
+// called in order for each frame which could be delivered,
+// if selected frame_nb is its Lima frame number
+//-----------------------------------------------------
+bool Decimation::select(int& frame_nb)
+{
+  bool selected;
+  switch(m_policy)
+    {
+    case EveryNth:
+      selected = !(m_nb_candidates % m_every_nth);
+      break;
+    case FirstAfterPeriod:
+      {
+	double now = _now();
+	selected = now >= m_next_time;
+	if(selected)
+	  m_next_time = now + m_period;
+      }
+      break;
+    default:
+      selected = true;
+      break;
+    }
+  ++m_nb_candidates;
+  if(selected)
+    frame_nb = m_nb_delivered++;
+  return selected;
+}
+
+double Decimation::_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
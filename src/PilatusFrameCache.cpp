@@ -0,0 +1,159 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <stdlib.h>
+#include "Exceptions.h"
+#include "PilatusFrameCache.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+void FrameCache::Ref::_get()
+{
+  if(m_frame)
+    __sync_add_and_fetch(&m_frame->ref_count,1);
+}
+
+void FrameCache::Ref::_put()
+{
+  if(m_frame && !__sync_sub_and_fetch(&m_frame->ref_count,1))
+    {
+      free(m_frame->data);
+      delete m_frame;
+    }
+  m_frame = NULL;
+}
+
+FrameCache::FrameCache() :
+  m_budget(0),
+  m_mem_size(0),
+  m_nb_hits(0),
+  m_nb_misses(0)
+{
+  DEB_CONSTRUCTOR();
+}
+
+FrameCache::~FrameCache()
+{
+  DEB_DESTRUCTOR();
+  clear();
+}
+//-----------------------------------------------------
+// size in bytes of the frames kept, 0 disables
+//-----------------------------------------------------
+void FrameCache::setBudget(long long nb_bytes)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(nb_bytes);
+  if(nb_bytes < 0)
+    THROW_HW_ERROR(InvalidValue) << "Invalid cache size: " << DEB_VAR1(nb_bytes);
+
+  AutoMutex aLock(m_mutex);
+  m_budget = nb_bytes;
+  _evict(m_budget);
+}
+
+long long FrameCache::budget() const
+{
+  AutoMutex aLock(m_mutex);
+  return m_budget;
+}
+
+bool FrameCache::get(const std::string& full_path,long long mtime,Ref& frame)
+{
+  AutoMutex aLock(m_mutex);
+  EntryMap::iterator i = m_map.find(Key(full_path,mtime));
+  if(i == m_map.end())
+    {
+      ++m_nb_misses;
+      return false;
+    }
+  ++m_nb_hits;
+  m_entries.splice(m_entries.begin(),m_entries,i->second);
+  frame = i->second->frame;
+  return true;
+}
+//-----------------------------------------------------
+// data (posix_memalign) is owned by the cache from now,
+// a frame bigger than the budget is only referenced
+//-----------------------------------------------------
+FrameCache::Ref FrameCache::insert(const std::string& full_path,long long mtime,
+				   int width,int height,void* data)
+{
+  Frame* frame = new Frame;
+  frame->width = width;
+  frame->height = height;
+  frame->data = (int*)data;
+  frame->mem_size = (long long)width * height * sizeof(int);
+  frame->ref_count = 0;
+  Ref ref(frame);
+
+  AutoMutex aLock(m_mutex);
+  if(frame->mem_size > m_budget)
+    return ref;
+
+  Key key(full_path,mtime);
+  EntryMap::iterator i = m_map.find(key);
+  if(i != m_map.end())		// decoded twice at the same time
+    {
+      m_mem_size -= i->second->frame->mem_size;
+      m_entries.erase(i->second);
+      m_map.erase(i);
+    }
+  _evict(m_budget - frame->mem_size);
+  Entry entry;
+  entry.key = key;
+  entry.frame = ref;
+  m_entries.push_front(entry);
+  m_map[key] = m_entries.begin();
+  m_mem_size += frame->mem_size;
+  return ref;
+}
+
+void FrameCache::clear()
+{
+  AutoMutex aLock(m_mutex);
+  m_entries.clear();
+  m_map.clear();
+  m_mem_size = 0;
+}
+
+void FrameCache::getStats(Stats& stats) const
+{
+  AutoMutex aLock(m_mutex);
+  stats.nb_hits = m_nb_hits;
+  stats.nb_misses = m_nb_misses;
+  stats.mem_size = m_mem_size;
+  stats.nb_frames = m_map.size();
+}
+//-----------------------------------------------------
+// drop the least recently used frames (lock held)
+//-----------------------------------------------------
+void FrameCache::_evict(long long budget)
+{
+  while(!m_entries.empty() && m_mem_size > budget)
+    {
+      Entry& entry = m_entries.back();
+      m_mem_size -= entry.frame->mem_size;
+      m_map.erase(entry.key);
+      m_entries.pop_back();
+    }
+}
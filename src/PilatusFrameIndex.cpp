@@ -0,0 +1,321 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Exceptions.h"
+#include "PilatusFrameIndex.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+static const char INDEX_MAGIC[8] = {'P','I','L','F','I','D','X','2'};
+static const int INITIAL_CAPACITY = 4096;
+static const long MAX_HEADER_SIZE = 64 * 1024;
+static const char BINARY_MARKER[4] = {'\x0c','\x1a','\x04','\xd5'};
+
+//-----------------------------------------------------
+// value after key in a CBF header, NaN if not found
+//-----------------------------------------------------
+static double _headerValue(const char* header,const char* key)
+{
+  const char* position = strstr(header,key);
+  if(!position)
+    return NAN;
+  return strtod(position + strlen(key),NULL);
+}
+
+FrameIndex::FrameIndex() :
+  m_fd(-1),
+  m_header(NULL),
+  m_map_size(0)
+{
+  DEB_CONSTRUCTOR();
+}
+
+FrameIndex::~FrameIndex()
+{
+  DEB_DESTRUCTOR();
+  close();
+}
+//-----------------------------------------------------
+// index of the series starting at first_number, an index
+// of the same series (same first number) is continued
+//-----------------------------------------------------
+void FrameIndex::open(const std::string& directory,const std::string& prefix,
+		      const std::string& suffix,int first_number)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR4(directory,prefix,suffix,first_number);
+
+  close();
+
+  AutoMutex aLock(m_mutex);
+  m_path = directory + "/" + prefix + ".index";
+  m_prefix = prefix;
+  m_suffix = suffix;
+  m_fd = ::open(m_path.c_str(),O_RDWR | O_CREAT,0644);
+  if(m_fd < 0)
+    THROW_HW_ERROR(Error) << "Can't open frame index: " << DEB_VAR1(m_path);
+
+  Header header;
+  bool aContinued = pread(m_fd,&header,sizeof(header),0) == sizeof(header) &&
+    !memcmp(header.magic,INDEX_MAGIC,sizeof(INDEX_MAGIC)) &&
+    header.record_size == sizeof(Record) &&
+    header.first_number == first_number;
+  int capacity = aContinued ? header.capacity : INITIAL_CAPACITY;
+  if(!aContinued && ftruncate(m_fd,0))
+    {
+      aLock.unlock();
+      close();
+      THROW_HW_ERROR(Error) << "Can't reset frame index: " << DEB_VAR1(m_path);
+    }
+  _grow(capacity);
+  if(!m_header)
+    {
+      aLock.unlock();
+      close();
+      THROW_HW_ERROR(Error) << "Can't map frame index: " << DEB_VAR1(m_path);
+    }
+  if(!aContinued)
+    {
+      memcpy(m_header->magic,INDEX_MAGIC,sizeof(INDEX_MAGIC));
+      m_header->record_size = sizeof(Record);
+      m_header->first_number = first_number;
+    }
+}
+
+void FrameIndex::close()
+{
+  AutoMutex aLock(m_mutex);
+  if(m_header)
+    munmap(m_header,m_map_size);
+  if(m_fd >= 0)
+    ::close(m_fd);
+  m_header = NULL;
+  m_map_size = 0;
+  m_fd = -1;
+}
+
+bool FrameIndex::isOpen() const
+{
+  AutoMutex aLock(m_mutex);
+  return m_header;
+}
+//-----------------------------------------------------
+// parse the header of a closed file, false if it's not
+// a file of the series or not a CBF
+//-----------------------------------------------------
+bool FrameIndex::add(const std::string& full_path)
+{
+  DEB_MEMBER_FUNCT();
+
+  size_t pos = full_path.rfind('/');
+  std::string file_name = pos == std::string::npos ? full_path :
+    full_path.substr(pos + 1);
+  int file_number = fileNumber(file_name);
+  if(file_number < 0 || file_name.size() >= sizeof(Record().file_name))
+    return false;
+
+  int fd = ::open(full_path.c_str(),O_RDONLY);
+  if(fd < 0)
+    return false;
+  char* data = (char*)malloc(MAX_HEADER_SIZE + 1);
+  ssize_t nb_read = data ? pread(fd,data,MAX_HEADER_SIZE,0) : -1;
+  ::close(fd);
+
+  Record record;
+  bool ok = nb_read > 0 && parse(data,nb_read,record);
+  free(data);
+  if(!ok)
+    return false;
+  record.file_number = file_number;
+  strcpy(record.file_name,file_name.c_str());
+
+  AutoMutex aLock(m_mutex);
+  if(!m_header)
+    return false;
+  int slot = file_number - m_header->first_number;
+  if(slot < 0)
+    return false;
+  if(slot >= m_header->capacity)
+    {
+      int capacity = m_header->capacity * 2;
+      _grow(capacity > slot ? capacity : slot + 1);
+      if(!m_header)
+	return false;
+    }
+  Record* records = (Record*)(m_header + 1);
+  Record& entry = records[slot];
+  entry.valid = 0;
+  __sync_synchronize();
+  record.valid = 0;
+  entry = record;
+  __sync_synchronize();
+  entry.valid = 1;
+  return true;
+}
+
+bool FrameIndex::lookup(int file_number,Record& record) const
+{
+  AutoMutex aLock(m_mutex);
+  if(!m_header)
+    return false;
+  int slot = file_number - m_header->first_number;
+  if(slot < 0 || slot >= m_header->capacity)
+    return false;
+  record = ((const Record*)(m_header + 1))[slot];
+  return record.valid;
+}
+//-----------------------------------------------------
+// number of a file name of the series, -1 if it isn't
+//-----------------------------------------------------
+int FrameIndex::fileNumber(const std::string& file_name) const
+{
+  AutoMutex aLock(m_mutex);
+  size_t prefix_size = m_prefix.size(),suffix_size = m_suffix.size();
+  if(file_name.size() <= prefix_size + suffix_size ||
+     file_name.compare(0,prefix_size,m_prefix) ||
+     file_name.compare(file_name.size() - suffix_size,suffix_size,m_suffix))
+    return -1;
+  std::string number = file_name.substr(prefix_size,file_name.size() -
+					prefix_size - suffix_size);
+  char* end;
+  long file_number = strtol(number.c_str(),&end,10);
+  return *end || file_number < 0 ? -1 : int(file_number);
+}
+//-----------------------------------------------------
+// fill record from the beginning of a CBF file
+//-----------------------------------------------------
+bool FrameIndex::parse(const char* data,long size,Record& record)
+{
+  memset(&record,0,sizeof(record));
+  const char* marker = (const char*)memmem(data,size,BINARY_MARKER,
+					   sizeof(BINARY_MARKER));
+  if(!marker)
+    return false;
+
+  std::string header(data,marker - data);
+  const char* text = header.c_str();
+  record.binary_offset = marker - data + sizeof(BINARY_MARKER);
+  record.binary_size = (int64_t)_headerValue(text,"X-Binary-Size:");
+  record.width = (int32_t)_headerValue(text,"X-Binary-Size-Fastest-Dimension:");
+  record.height = (int32_t)_headerValue(text,"X-Binary-Size-Second-Dimension:");
+  // the quoted type, "signed" is also in "unsigned"
+  if(strstr(text,"\"signed 32-bit integer\""))
+    {
+      record.element_size = 4;
+      record.is_signed = 1;
+    }
+  else if(strstr(text,"\"unsigned 32-bit integer\""))
+    record.element_size = 4;
+  if(strstr(text,"x-CBF_BYTE_OFFSET"))
+    record.compression = ByteOffset;
+  else if(strstr(text,"x-CBF_NONE"))
+    record.compression = Uncompressed;
+  else
+    record.compression = Unknown;
+  record.exposure_time = _headerValue(text,"# Exposure_time");
+  record.exposure_period = _headerValue(text,"# Exposure_period");
+  record.start_angle = _headerValue(text,"# Start_angle");
+  record.angle_increment = _headerValue(text,"# Angle_increment");
+  return record.binary_size > 0 && record.width > 0 && record.height > 0;
+}
+//-----------------------------------------------------
+// CBF byte offset: deltas on 1 byte, escaped to 2, 4 and 8
+//-----------------------------------------------------
+bool FrameIndex::decodeByteOffset(const char* data,long size,
+				  int* pixels,long nb_pixels)
+{
+  const unsigned char* p = (const unsigned char*)data;
+  const unsigned char* end = p + size;
+  long long value = 0;
+  for(long i = 0;i < nb_pixels;++i)
+    {
+      if(p >= end)
+	return false;
+      long long delta = (signed char)*p++;
+      if(delta == -128)
+	{
+	  if(p + 2 > end)
+	    return false;
+	  delta = (short)(p[0] | (p[1] << 8));
+	  p += 2;
+	  if(delta == -32768)
+	    {
+	      if(p + 4 > end)
+		return false;
+	      int32_t delta32;
+	      memcpy(&delta32,p,4);
+	      p += 4;
+	      delta = delta32;
+	      if(delta32 == -2147483647 - 1)
+		{
+		  if(p + 8 > end)
+		    return false;
+		  int64_t delta64;
+		  memcpy(&delta64,p,8);
+		  p += 8;
+		  delta = delta64;
+		}
+	    }
+	}
+      value += delta;
+      pixels[i] = int(value);
+    }
+  return true;
+}
+//-----------------------------------------------------
+// resize the file and map it again (lock held)
+//-----------------------------------------------------
+void FrameIndex::_grow(int capacity)
+{
+  DEB_MEMBER_FUNCT();
+
+  long map_size = sizeof(Header) + long(capacity) * sizeof(Record);
+  if(m_header)
+    munmap(m_header,m_map_size);
+  m_header = NULL;
+  m_map_size = 0;
+
+  struct stat file_stat;
+  if(fstat(m_fd,&file_stat) ||
+     (file_stat.st_size < map_size && ftruncate(m_fd,map_size)))
+    {
+      DEB_ERROR() << "Can't resize frame index: " << DEB_VAR1(m_path);
+      return;
+    }
+  void* map_base = mmap(NULL,map_size,PROT_READ | PROT_WRITE,MAP_SHARED,m_fd,0);
+  if(map_base == MAP_FAILED)
+    {
+      DEB_ERROR() << "Can't map frame index: " << DEB_VAR1(m_path);
+      return;
+    }
+  m_header = (Header*)map_base;
+  m_map_size = map_size;
+  m_header->capacity = capacity;
+}
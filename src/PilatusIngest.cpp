@@ -0,0 +1,535 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <string.h>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "Exceptions.h"
+#include "PilatusIngest.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+/*******************************************************************
+ * \brief ModuleGeometry
+ *******************************************************************/
+ModuleGeometry::ModuleGeometry() :
+  m_nb_module_x(0),
+  m_nb_module_y(0)
+{
+}
+//-----------------------------------------------------
+// module tiling is deduced from the detector size,
+// it's not valid if the size doesn't match any tiling.
+//-----------------------------------------------------
+ModuleGeometry::ModuleGeometry(const std::string& model,
+			       const Size& det_size) :
+  m_model(model),
+  m_det_size(det_size),
+  m_nb_module_x(0),
+  m_nb_module_y(0)
+{
+  DEB_CONSTRUCTOR();
+
+  int width = det_size.getWidth() + GAP_WIDTH;
+  int height = det_size.getHeight() + GAP_HEIGHT;
+  if(width % (MODULE_WIDTH + GAP_WIDTH) ||
+     height % (MODULE_HEIGHT + GAP_HEIGHT))
+    {
+      DEB_WARNING() << "Can't find module tiling of " << DEB_VAR2(model,det_size);
+      return;
+    }
+  m_nb_module_x = width / (MODULE_WIDTH + GAP_WIDTH);
+  m_nb_module_y = height / (MODULE_HEIGHT + GAP_HEIGHT);
+  DEB_TRACE() << DEB_VAR3(model,m_nb_module_x,m_nb_module_y);
+}
+
+Size ModuleGeometry::compactedSize() const
+{
+  if(!isValid())
+    return m_det_size;
+  return Size(m_nb_module_x * MODULE_WIDTH,m_nb_module_y * MODULE_HEIGHT);
+}
+
+Roi ModuleGeometry::rawModuleRoi(int module) const
+{
+  int module_x = module % m_nb_module_x;
+  int module_y = module / m_nb_module_x;
+  return Roi(module_x * (MODULE_WIDTH + GAP_WIDTH),
+	     module_y * (MODULE_HEIGHT + GAP_HEIGHT),
+	     MODULE_WIDTH,MODULE_HEIGHT);
+}
+
+Roi ModuleGeometry::compactedModuleRoi(int module) const
+{
+  int module_x = module % m_nb_module_x;
+  int module_y = module / m_nb_module_x;
+  return Roi(module_x * MODULE_WIDTH,module_y * MODULE_HEIGHT,
+	     MODULE_WIDTH,MODULE_HEIGHT);
+}
+//-----------------------------------------------------
+// mask in the raw layout, 1 for gap pixels 0 otherwise
+//-----------------------------------------------------
+void ModuleGeometry::getGapMask(std::vector<unsigned char>& mask) const
+{
+  int width = m_det_size.getWidth();
+  mask.assign(long(width) * m_det_size.getHeight(),isValid() ? 1 : 0);
+  for(int module = 0;module < nbModules();++module)
+    {
+      Roi roi = rawModuleRoi(module);
+      const Point& topleft = roi.getTopLeft();
+      for(int y = 0;y < MODULE_HEIGHT;++y)
+	memset(&mask[long(topleft.y + y) * width + topleft.x],0,MODULE_WIDTH);
+    }
+}
+
+/*******************************************************************
+ * \brief binning kernels
+ *
+ * Pixels are summed in 32 bits. Negative pixels (gap -1, bad -2)
+ * don't contribute to the sum and the result is clamped to the
+ * max positive value instead of wrapping.
+ *******************************************************************/
+static const unsigned int BIN_SATURATION = 0x7fffffff;
+static const int MAX_BIN = 16;
+
+static void _accumulate_line_scalar(unsigned int* acc,const int* line,int width)
+{
+  for(int x = 0;x < width;++x)
+    {
+      unsigned int value = line[x] > 0 ? line[x] : 0;
+      unsigned int sum = acc[x] + value;
+      acc[x] = sum > BIN_SATURATION ? BIN_SATURATION : sum;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void _accumulate_line_avx2(unsigned int* acc,const int* line,int width)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i saturation = _mm256_set1_epi32(BIN_SATURATION);
+  int x = 0;
+  for(;x + 8 <= width;x += 8)
+    {
+      __m256i value = _mm256_max_epi32(_mm256_loadu_si256((const __m256i*)(line + x)),
+				       zero);
+      __m256i sum = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(acc + x)),
+				     value);
+      _mm256_storeu_si256((__m256i*)(acc + x),_mm256_min_epu32(sum,saturation));
+    }
+  _accumulate_line_scalar(acc + x,line + x,width - x);
+}
+
+typedef void (*_accumulate_line_func)(unsigned int*,const int*,int);
+static _accumulate_line_func _get_accumulate_line()
+{
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return _accumulate_line_avx2;
+  return _accumulate_line_scalar;
+}
+static const _accumulate_line_func _accumulate_line = _get_accumulate_line();
+#else
+#define _accumulate_line _accumulate_line_scalar
+#endif
+
+//-----------------------------------------------------
+// frame summation, negative pixels (gap, bad) are kept
+// as is, others are added with saturation.
+//-----------------------------------------------------
+static void _sum_frame_scalar(int* dst,const int* src,long nb_pixels)
+{
+  for(long i = 0;i < nb_pixels;++i)
+    {
+      if(dst[i] < 0 || src[i] < 0)
+	dst[i] = std::min(dst[i],src[i]);
+      else
+	{
+	  unsigned int sum = unsigned(dst[i]) + unsigned(src[i]);
+	  dst[i] = int(sum > BIN_SATURATION ? BIN_SATURATION : sum);
+	}
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void _sum_frame_avx2(int* dst,const int* src,long nb_pixels)
+{
+  const __m256i saturation = _mm256_set1_epi32(BIN_SATURATION);
+  long i = 0;
+  for(;i + 8 <= nb_pixels;i += 8)
+    {
+      __m256i a = _mm256_loadu_si256((const __m256i*)(dst + i));
+      __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+      __m256i negative = _mm256_srai_epi32(_mm256_or_si256(a,b),31);
+      __m256i sum = _mm256_min_epu32(_mm256_add_epi32(a,b),saturation);
+      __m256i result = _mm256_blendv_epi8(sum,_mm256_min_epi32(a,b),negative);
+      _mm256_storeu_si256((__m256i*)(dst + i),result);
+    }
+  _sum_frame_scalar(dst + i,src + i,nb_pixels - i);
+}
+
+typedef void (*_sum_frame_func)(int*,const int*,long);
+static _sum_frame_func _get_sum_frame()
+{
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return _sum_frame_avx2;
+  return _sum_frame_scalar;
+}
+static const _sum_frame_func _sum_frame = _get_sum_frame();
+#else
+#define _sum_frame _sum_frame_scalar
+#endif
+
+static void _reduce_line(int* dst,const unsigned int* acc,int width,int bin_x)
+{
+  for(int x = 0;x < width;++x,acc += bin_x)
+    {
+      unsigned int sum = 0;
+      for(int i = 0;i < bin_x;++i)
+	{
+	  sum += acc[i];
+	  if(sum > BIN_SATURATION)
+	    sum = BIN_SATURATION;
+	}
+      dst[x] = int(sum);
+    }
+}
+
+/*******************************************************************
+ * \brief Ingest
+ *******************************************************************/
+Ingest::Ingest() :
+  m_gap_compaction(false),
+  m_nb_frames_summed(1),
+  m_correction(NULL),
+  m_line_width(0)
+{
+  DEB_CONSTRUCTOR();
+}
+
+Ingest::~Ingest()
+{
+  DEB_DESTRUCTOR();
+}
+
+void Ingest::setGeometry(const ModuleGeometry& geometry)
+{
+  DEB_MEMBER_FUNCT();
+
+  m_geometry = geometry;
+  m_gap_compaction = false;
+  m_bin = Bin();
+  m_roi = Roi();
+  _updateLayout();
+}
+//-----------------------------------------------------
+// roi is reset as the image layout change
+//-----------------------------------------------------
+void Ingest::setGapCompaction(bool flag)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(flag);
+
+  if(flag && !m_geometry.isValid())
+    THROW_HW_ERROR(NotSupported) << "Gap compaction not possible, "
+				 << "unknown module tiling for "
+				 << DEB_VAR1(m_geometry.model());
+  m_gap_compaction = flag;
+  m_roi = Roi();
+  _updateLayout();
+}
+//-----------------------------------------------------
+// any binning from 1 to MAX_BIN, asymmetric or not
+//-----------------------------------------------------
+void Ingest::checkBin(Bin& bin) const
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(bin);
+
+  int bin_x = std::max(1,std::min(bin.getX(),MAX_BIN));
+  int bin_y = std::max(1,std::min(bin.getY(),MAX_BIN));
+  bin = Bin(bin_x,bin_y);
+
+  DEB_RETURN() << DEB_VAR1(bin);
+}
+//-----------------------------------------------------
+// roi is reset as the image layout change
+//-----------------------------------------------------
+void Ingest::setBin(const Bin& bin)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(bin);
+
+  Bin hw_bin = bin;
+  checkBin(hw_bin);
+  if(hw_bin != bin)
+    THROW_HW_ERROR(InvalidValue) << "Binning not supported: " << DEB_VAR1(bin);
+  if(hw_bin == m_bin)
+    return;
+  m_bin = hw_bin;
+  m_roi = Roi();
+  _updateLayout();
+}
+
+void Ingest::getBin(Bin& bin) const
+{
+  bin = m_bin;
+}
+//-----------------------------------------------------
+// Any rectangle inside the image is valid, module
+// aligned or not.
+//-----------------------------------------------------
+void Ingest::checkRoi(const Roi& set_roi,Roi& hw_roi) const
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(set_roi);
+
+  if(!set_roi.isActive())
+    {
+      hw_roi = set_roi;
+      return;
+    }
+
+  Size binned_size;
+  _getBinnedSize(binned_size);
+  const Point& topleft = set_roi.getTopLeft();
+  const Size& size = set_roi.getSize();
+  if(topleft.x < 0 || topleft.y < 0 ||
+     topleft.x + size.getWidth() > binned_size.getWidth() ||
+     topleft.y + size.getHeight() > binned_size.getHeight())
+    THROW_HW_ERROR(InvalidValue) << "Roi out of detector: "
+				 << DEB_VAR2(set_roi,binned_size);
+
+  // full frame roi is not a roi
+  if(size == binned_size)
+    hw_roi = Roi();
+  else
+    hw_roi = set_roi;
+
+  DEB_RETURN() << DEB_VAR1(hw_roi);
+}
+
+void Ingest::setRoi(const Roi& set_roi)
+{
+  DEB_MEMBER_FUNCT();
+
+  Roi hw_roi;
+  checkRoi(set_roi,hw_roi);
+  m_roi = hw_roi;
+  _updateLayout();
+}
+
+void Ingest::getRoi(Roi& hw_roi) const
+{
+  hw_roi = m_roi;
+}
+//-----------------------------------------------------
+// correction table is owned by the caller, it's used
+// only if active.
+//-----------------------------------------------------
+void Ingest::setCorrection(const Correction* correction)
+{
+  m_correction = correction;
+}
+//-----------------------------------------------------
+// number of consecutive raw frames summed in one frame
+//-----------------------------------------------------
+void Ingest::setNbFramesSummed(int nb_frames)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(nb_frames);
+
+  if(nb_frames < 1)
+    THROW_HW_ERROR(InvalidValue) << "Invalid number of summed frames: "
+				 << DEB_VAR1(nb_frames);
+  m_nb_frames_summed = nb_frames;
+}
+//-----------------------------------------------------
+// Size of the frame given to Lima
+//-----------------------------------------------------
+void Ingest::getImageSize(Size& size) const
+{
+  if(m_roi.isActive())
+    size = m_roi.getSize();
+  else
+    _getBinnedSize(size);
+}
+
+bool Ingest::isPassThrough() const
+{
+  return _isIdentityLayout() && !_isCorrected() && m_nb_frames_summed == 1;
+}
+//-----------------------------------------------------
+// src is the full raw frame, dst must hold getImageSize
+//-----------------------------------------------------
+void Ingest::process(const int* src,int* dst) const
+{
+  Size size;
+  getImageSize(size);
+  int width = size.getWidth();
+
+  if(m_bin.isOne())
+    {
+      for(std::vector<long>::const_iterator line = m_line_offsets.begin();
+	  line != m_line_offsets.end();++line,dst += width)
+	{
+	  const int* src_line = src + *line;
+	  for(std::vector<Run>::const_iterator run = m_runs.begin();
+	      run != m_runs.end();++run)
+	    _copyRun(dst,src_line,*line,*run);
+	}
+      return;
+    }
+
+  // source lines are gathered only if they are not contiguous (compaction)
+  // or corrected
+  bool gather = m_runs.size() > 1 || _isCorrected();
+  std::vector<int> line_buffer(gather ? m_line_width : 0);
+  std::vector<unsigned int> acc(m_line_width);
+  int bin_y = m_bin.getY();
+  std::vector<long>::const_iterator line = m_line_offsets.begin();
+  while(line != m_line_offsets.end())
+    {
+      std::fill(acc.begin(),acc.end(),0);
+      for(int i = 0;i < bin_y;++i,++line)
+	{
+	  const int* src_line = src + *line;
+	  if(gather)
+	    {
+	      for(std::vector<Run>::const_iterator run = m_runs.begin();
+		  run != m_runs.end();++run)
+		_copyRun(&line_buffer[0],src_line,*line,*run);
+	      src_line = &line_buffer[0];
+	    }
+	  else
+	    src_line += m_runs.front().src;
+	  _accumulate_line(&acc[0],src_line,m_line_width);
+	}
+      _reduce_line(dst,&acc[0],width,m_bin.getX());
+      dst += width;
+    }
+}
+
+//-----------------------------------------------------
+// add the transformed src frame to dst, scratch is only
+// used if src is not given as is.
+//-----------------------------------------------------
+void Ingest::accumulate(const int* src,int* dst,
+			std::vector<int>& scratch) const
+{
+  Size size;
+  getImageSize(size);
+  long nb_pixels = long(size.getWidth()) * size.getHeight();
+  if(!_isIdentityLayout() || _isCorrected())
+    {
+      scratch.resize(nb_pixels);
+      process(src,&scratch[0]);
+      src = &scratch[0];
+    }
+  _sum_frame(dst,src,nb_pixels);
+}
+
+bool Ingest::_isIdentityLayout() const
+{
+  return !m_roi.isActive() && !m_gap_compaction && m_bin.isOne();
+}
+
+bool Ingest::_isCorrected() const
+{
+  return m_correction && m_correction->isActive();
+}
+
+void Ingest::_copyRun(int* dst,const int* src_line,long line_offset,
+		      const Run& run) const
+{
+  if(_isCorrected())
+    m_correction->apply(dst + run.dst,src_line + run.src,
+			line_offset + run.src,run.len);
+  else
+    memcpy(dst + run.dst,src_line + run.src,run.len * sizeof(int));
+}
+
+void Ingest::_getSourceSize(Size& size) const
+{
+  size = m_gap_compaction ? m_geometry.compactedSize() :
+    m_geometry.detectorSize();
+}
+
+void Ingest::_getBinnedSize(Size& size) const
+{
+  Size source_size;
+  _getSourceSize(source_size);
+  size = Size(source_size.getWidth() / m_bin.getX(),
+	      source_size.getHeight() / m_bin.getY());
+}
+//-----------------------------------------------------
+// Pre-compute the raw offset of each source line read
+// (bin_y lines per output line) and the contiguous runs
+// of a line. Without compaction, each line is a single run.
+//-----------------------------------------------------
+void Ingest::_updateLayout()
+{
+  Size binned_size;
+  _getBinnedSize(binned_size);
+  Roi roi = m_roi.isActive() ? m_roi : Roi(Point(0,0),binned_size);
+  int bin_x = m_bin.getX(),bin_y = m_bin.getY();
+  int first_x = roi.getTopLeft().x * bin_x;
+  int first_y = roi.getTopLeft().y * bin_y;
+  int width = roi.getSize().getWidth() * bin_x;
+  int height = roi.getSize().getHeight() * bin_y;
+  int det_width = m_geometry.detectorSize().getWidth();
+
+  m_line_width = width;
+  m_line_offsets.resize(height);
+  for(int y = 0;y < height;++y)
+    {
+      int raw_y = first_y + y;
+      if(m_gap_compaction)
+	raw_y += (raw_y / ModuleGeometry::MODULE_HEIGHT) * ModuleGeometry::GAP_HEIGHT;
+      m_line_offsets[y] = long(raw_y) * det_width;
+    }
+
+  m_runs.clear();
+  if(!m_gap_compaction)
+    {
+      Run run = {0,first_x,width};
+      m_runs.push_back(run);
+      return;
+    }
+
+  for(int x = 0;x < width;)
+    {
+      int compacted_x = first_x + x;
+      int module_x = compacted_x / ModuleGeometry::MODULE_WIDTH;
+      int module_end = (module_x + 1) * ModuleGeometry::MODULE_WIDTH;
+      Run run;
+      run.dst = x;
+      run.src = compacted_x + module_x * ModuleGeometry::GAP_WIDTH;
+      run.len = std::min(module_end - compacted_x,width - x);
+      m_runs.push_back(run);
+      x += run.len;
+    }
+}
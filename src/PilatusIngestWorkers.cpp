@@ -0,0 +1,324 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Exceptions.h"
+#include "PilatusIngest.h"
+#include "PilatusIngestWorkers.h"
+#include "PilatusPlacement.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+static const int READ_AHEAD_PER_WORKER = 2;
+
+IngestWorkers::IngestWorkers(const Ingest& ingest) :
+  m_ingest(ingest),
+  m_placement(NULL),
+  m_quit(false),
+  m_data_offset(0),
+  m_map_length(0),
+  m_frame_mem_size(0),
+  m_process(false)
+{
+  DEB_CONSTRUCTOR();
+}
+
+IngestWorkers::~IngestWorkers()
+{
+  DEB_DESTRUCTOR();
+  release();
+  _stopThreads();
+}
+//-----------------------------------------------------
+// must not be changed during an acquisition
+//-----------------------------------------------------
+void IngestWorkers::setNbWorkers(int nb_workers)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(nb_workers);
+  if(nb_workers < 0)
+    THROW_HW_ERROR(InvalidValue) << "Invalid number of workers: "
+				 << DEB_VAR1(nb_workers);
+  if(nb_workers == nbWorkers())
+    return;
+
+  release();
+  _stopThreads();
+  _startThreads(nb_workers);
+}
+
+int IngestWorkers::nbWorkers() const
+{
+  AutoMutex aLock(m_cond.mutex());
+  return m_threads.size();
+}
+
+void IngestWorkers::getThreadIds(std::vector<pthread_t>& thread_ids) const
+{
+  AutoMutex aLock(m_cond.mutex());
+  thread_ids = m_threads;
+}
+//-----------------------------------------------------
+// numa placement of the ingested frame buffers
+//-----------------------------------------------------
+void IngestWorkers::setPlacement(const Placement* placement)
+{
+  AutoMutex aLock(m_cond.mutex());
+  m_placement = placement;
+}
+//-----------------------------------------------------
+// called when the acquisition is prepared
+//-----------------------------------------------------
+void IngestWorkers::prepare(const std::string& watch_path,
+			    const std::string& file_pattern,
+			    long data_offset,long map_length,
+			    long frame_mem_size,bool process)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR4(watch_path,file_pattern,map_length,process);
+
+  release();
+
+  AutoMutex aLock(m_cond.mutex());
+  m_watch_path = watch_path;
+  m_file_pattern = file_pattern;
+  m_data_offset = data_offset;
+  m_map_length = map_length;
+  m_frame_mem_size = frame_mem_size;
+  m_process = process;
+}
+//-----------------------------------------------------
+// get the result of image_number if it was read ahead,
+// and schedule the following files up to nb_images (<= 0 no limit).
+// Result must be freed by the caller.
+//-----------------------------------------------------
+bool IngestWorkers::take(int image_number,int nb_images,Result& result)
+{
+  AutoMutex aLock(m_cond.mutex());
+  if(m_threads.empty())
+    return false;
+
+  bool found = false;
+  Slot& slot = m_slots[image_number % m_slots.size()];
+  if(slot.image_number == image_number)
+    {
+      while(slot.state == Running)
+	m_cond.wait();
+      if(slot.state == Done)
+	{
+	  result = slot.result;
+	  found = true;
+	}
+      slot.image_number = -1;
+      slot.state = Free;
+    }
+
+  int last_image_number = image_number + m_slots.size();
+  if(nb_images > 0 && last_image_number > nb_images - 1)
+    last_image_number = nb_images - 1;
+  _schedule(image_number + 1,last_image_number);
+
+  return found;
+}
+//-----------------------------------------------------
+// free the results not taken, i.e after a stop
+//-----------------------------------------------------
+void IngestWorkers::release()
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex aLock(m_cond.mutex());
+  for(std::vector<Slot>::iterator i = m_slots.begin();i != m_slots.end();++i)
+    if(i->state == Pending || i->state == Missing)
+      i->state = Free;
+
+  for(std::vector<Slot>::iterator i = m_slots.begin();i != m_slots.end();++i)
+    {
+      while(i->state == Running)
+	m_cond.wait();
+      if(i->state == Done)
+	_free(i->result);
+      i->image_number = -1;
+      i->state = Free;
+    }
+}
+
+void IngestWorkers::_schedule(int first_image_number,int last_image_number)
+{
+  bool scheduled = false;
+  for(int image_number = first_image_number;
+      image_number <= last_image_number;++image_number)
+    {
+      Slot& slot = m_slots[image_number % m_slots.size()];
+      if(slot.image_number == image_number)
+	{
+	  if(slot.state != Missing)
+	    continue;		// already read or in progress
+	}
+      else if(slot.state == Running)
+	continue;		// older file, freed next time
+      else if(slot.state == Done)
+	_free(slot.result);	// older file never taken
+
+      slot.image_number = image_number;
+      slot.state = Pending;
+      scheduled = true;
+    }
+  if(scheduled)
+    m_cond.broadcast();
+}
+
+void IngestWorkers::_startThreads(int nb_workers)
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex aLock(m_cond.mutex());
+  m_quit = false;
+  m_slots.resize(nb_workers * READ_AHEAD_PER_WORKER);
+  for(int i = 0;i < nb_workers;++i)
+    {
+      pthread_t thread_id;
+      if(pthread_create(&thread_id,NULL,_runFunc,this))
+	{
+	  aLock.unlock();
+	  _stopThreads();
+	  THROW_HW_ERROR(Error) << "Can't start ingest worker";
+	}
+      m_threads.push_back(thread_id);
+    }
+}
+
+void IngestWorkers::_stopThreads()
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex aLock(m_cond.mutex());
+  m_quit = true;
+  m_cond.broadcast();
+  std::vector<pthread_t> threads;
+  threads.swap(m_threads);
+  aLock.unlock();
+
+  for(std::vector<pthread_t>::iterator i = threads.begin();i != threads.end();++i)
+    pthread_join(*i,NULL);
+
+  aLock.lock();
+  m_slots.clear();
+}
+
+void* IngestWorkers::_runFunc(void* arg)
+{
+  ((IngestWorkers*)arg)->_run();
+  return NULL;
+}
+
+void IngestWorkers::_run()
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex aLock(m_cond.mutex());
+  while(!m_quit)
+    {
+      Slot* slot = NULL;
+      for(std::vector<Slot>::iterator i = m_slots.begin();i != m_slots.end();++i)
+	if(i->state == Pending)
+	  {
+	    slot = &*i;
+	    break;
+	  }
+      if(!slot)
+	{
+	  m_cond.wait();
+	  continue;
+	}
+
+      slot->state = Running;
+      int image_number = slot->image_number;
+      aLock.unlock();
+
+      Result result;
+      bool done = _read(image_number,result);
+
+      aLock.lock();
+      slot->result = result;
+      slot->state = done ? Done : Missing;
+      m_cond.broadcast();
+    }
+}
+//-----------------------------------------------------
+// false if the file is not yet (fully) written or can't be read,
+// it'll be read again by the directory event thread
+//-----------------------------------------------------
+bool IngestWorkers::_read(int image_number,Result& result) const
+{
+  char file_name[256];
+  snprintf(file_name,sizeof(file_name),m_file_pattern.c_str(),image_number);
+  std::string full_path = m_watch_path + "/" + file_name;
+
+  int fd = open(full_path.c_str(),O_RDONLY);
+  if(fd < 0)
+    return false;
+
+  struct stat file_stat;
+  if(fstat(fd,&file_stat) || file_stat.st_size < m_map_length)
+    {
+      close(fd);
+      return false;
+    }
+
+  void* map_base = mmap(NULL,m_map_length,PROT_READ,
+			MAP_SHARED | MAP_POPULATE,fd,0);
+  close(fd);
+  if(map_base == MAP_FAILED)
+    return false;
+
+  result.map_base = map_base;
+  result.map_length = m_map_length;
+  result.buffer = NULL;
+  if(m_process)
+    {
+      if(Placement::allocateFrame(&result.buffer,m_frame_mem_size))
+	{
+	  munmap(map_base,m_map_length);
+	  return false;
+	}
+      if(m_placement)
+	m_placement->bindMemory(result.buffer,m_frame_mem_size);
+      m_ingest.process((const int*)((char*)map_base + m_data_offset),
+		       (int*)result.buffer);
+      munmap(map_base,m_map_length);
+      result.map_base = NULL;
+    }
+  return true;
+}
+
+void IngestWorkers::_free(const Result& result)
+{
+  if(result.map_base)
+    munmap(result.map_base,result.map_length);
+  free(result.buffer);
+}
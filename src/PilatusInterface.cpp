@@ -20,6 +20,7 @@
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
 #include <algorithm>
+#include <dirent.h>
 #include <fcntl.h>
 #include <pwd.h>
 #include <sys/stat.h>
@@ -42,13 +43,17 @@ static const char CAMERA_PILATUS3_TOKEN[] = "PILATUS3";
 
 static const char WATCH_PATH[] = "/lima_data";
 static const char FILE_PATTERN[] = "tmp_img_%.5d.edf";
+static const char RAW_FILE_PATTERN[] = "tmp_raw_%.5d.edf";
+static const char RAW_FILE_PREFIX[] = "tmp_raw_";
+static const char ANNOUNCE_TMP_FILE[] = "tmp_img.announce";
 static const int  DECTRIS_EDF_OFFSET = 1024;
 
 /*******************************************************************
  * \brief DetInfoCtrlObj constructor
  * \param info if info is NULL look for ~det/p2_det/config/cam_data/camera.def file
  *******************************************************************/
-DetInfoCtrlObj::DetInfoCtrlObj(const DetInfoCtrlObj::Info* info)
+DetInfoCtrlObj::DetInfoCtrlObj(const DetInfoCtrlObj::Info* info) :
+  m_gap_compaction(false)
 {
     DEB_CONSTRUCTOR();
     if(info)
@@ -126,7 +131,10 @@ void DetInfoCtrlObj::getMaxImageSize(Size& size)
 {
     DEB_MEMBER_FUNCT();
     // get the max image size
-    getDetectorImageSize(size);
+    if(m_gap_compaction)
+      size = getModuleGeometry().compactedSize();
+    else
+      getDetectorImageSize(size);
 }
 
 //-----------------------------------------------------
@@ -202,7 +210,40 @@ void DetInfoCtrlObj::getDetectorModel(std::string& model)
 //-----------------------------------------------------
 double DetInfoCtrlObj::getMinLatTime() const
 {
-  return m_is_pilatus3 ? 950e-6 : 3e-3;
+  return getModelTiming().readout_time;
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+ModelTiming DetInfoCtrlObj::getModelTiming() const
+{
+  return ModelTiming::find(m_info.m_det_model);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+ModuleGeometry DetInfoCtrlObj::getModuleGeometry() const
+{
+  return ModuleGeometry(m_info.m_det_model,m_info.m_det_size);
+}
+//-----------------------------------------------------
+// with gap compaction max image size is the sum
+// of the modules size
+//-----------------------------------------------------
+void DetInfoCtrlObj::setGapCompaction(bool flag)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(flag);
+
+  if(flag == m_gap_compaction)
+    return;
+
+  m_gap_compaction = flag;
+  Size max_image_size;
+  getMaxImageSize(max_image_size);
+  ImageType image_type;
+  getCurrImageType(image_type);
+  m_mis_cb_gen.maxImageSizeChanged(max_image_size,image_type);
 }
 
 /*******************************************************************
@@ -210,7 +251,12 @@ double DetInfoCtrlObj::getMinLatTime() const
  *******************************************************************/
 
 SyncCtrlObj::SyncCtrlObj(Camera& cam,DetInfoCtrlObj &det_info)
-  :  m_cam(cam),m_latency(det_info.getMinLatTime())
+  :  m_cam(cam),m_det_info(det_info),
+     m_nb_frames(1),m_exposure_requested(0.),
+     m_latency(det_info.getMinLatTime()),m_min_latency(-1.),
+     m_nb_frames_summed(1),
+     m_decimation_policy(Decimation::Off),
+     m_decimation_every_nth(1)
 
 {
 }
@@ -320,11 +366,11 @@ void SyncCtrlObj::setLatTime(double lat_time)
 }
 
 //-----------------------------------------------------
-//
+// latency applied, after the model minimum
 //-----------------------------------------------------
 void SyncCtrlObj::getLatTime(double& lat_time)
 {
-    lat_time = m_latency;
+    lat_time = getExposurePeriod(m_exposure_requested) - m_exposure_requested;
 }
 
 //-----------------------------------------------------
@@ -343,17 +389,78 @@ void SyncCtrlObj::getNbHwFrames(int& nb_frames)
     nb_frames =  m_nb_frames;
 }
 
+//-----------------------------------------------------
+// each Lima frame is the sum of nb_frames detector frames
+//-----------------------------------------------------
+void SyncCtrlObj::setNbFramesSummed(int nb_frames)
+{
+    m_nb_frames_summed = nb_frames;
+}
+
+//-----------------------------------------------------
+// with EveryNth, the detector runs every_nth times more images
+//-----------------------------------------------------
+void SyncCtrlObj::setDecimation(Decimation::Policy policy,int every_nth)
+{
+    m_decimation_policy = policy;
+    m_decimation_every_nth = every_nth;
+}
+
 //-----------------------------------------------------
 //
 //-----------------------------------------------------
 void SyncCtrlObj::getValidRanges(ValidRangesType& valid_ranges)
 {
-    double min_time = 1e-9;
+    double exposure = m_exposure_requested;
+    ModelTiming timing = getModelTiming();
     double max_time = 1e6;
-    valid_ranges.min_exp_time = min_time;
+    valid_ranges.min_exp_time = timing.min_exposure;
     valid_ranges.max_exp_time = max_time;
-    valid_ranges.min_lat_time = m_latency;
-    valid_ranges.max_lat_time = max_time;
+    // the max frame rate may need more than the readout time
+    double min_latency = m_min_latency < 0. ?
+      timing.readout_time : m_min_latency;
+    double rate_latency = timing.minPeriod(exposure) - exposure;
+    valid_ranges.min_lat_time = std::max(min_latency,rate_latency);
+    // period must stay in the camserver range
+    valid_ranges.max_lat_time = max_time - exposure;
+}
+
+//-----------------------------------------------------
+// Lima live (no frame number) runs the detector until stop
+//-----------------------------------------------------
+bool SyncCtrlObj::isContinuous() const
+{
+    return !m_nb_frames && m_cam.triggerMode() != Camera::INTERNAL_MULTI;
+}
+
+//-----------------------------------------------------
+// measured minimum latency, it becomes the latency
+//-----------------------------------------------------
+void SyncCtrlObj::setMinLatTime(double lat_time)
+{
+    DEB_MEMBER_FUNCT();
+    DEB_PARAM() << DEB_VAR1(lat_time);
+    m_min_latency = lat_time;
+    m_latency = lat_time;
+}
+
+//-----------------------------------------------------
+// timing of the detector model
+//-----------------------------------------------------
+ModelTiming SyncCtrlObj::getModelTiming() const
+{
+    return m_det_info.getModelTiming();
+}
+
+//-----------------------------------------------------
+// period used for exposure with the current latency, raised
+// to the model minimum if needed
+//-----------------------------------------------------
+double SyncCtrlObj::getExposurePeriod(double exposure) const
+{
+    double exposure_period = exposure + m_latency;
+    double min_period = getModelTiming().minPeriod(exposure);
+    return exposure_period > min_period ? exposure_period : min_period;
 }
 
 //-----------------------------------------------------
@@ -361,17 +468,138 @@ void SyncCtrlObj::getValidRanges(ValidRangesType& valid_ranges)
 //-----------------------------------------------------
 void SyncCtrlObj::prepareAcq()
 {
+    DEB_MEMBER_FUNCT();
 
     double exposure =  m_exposure_requested;
-    double exposure_period = exposure + m_latency;
+    // slowed down to the model max frame rate if needed
+    double exposure_period = getExposurePeriod(exposure);
+    if(exposure_period > exposure + m_latency)
+      DEB_WARNING() << "Latency raised to the model minimum: "
+		    << DEB_VAR2(m_latency,exposure_period - exposure);
 
     m_cam.setExposurePeriod(exposure_period);
 
     TrigMode trig_mode;
     getTrigMode(trig_mode);
-    int nb_frames = (trig_mode == IntTrigMult)?1:m_nb_frames;
-    m_cam.setNbImagesInSequence(nb_frames);
+    if(trig_mode == IntTrigMult && m_nb_frames_summed > 1)
+      THROW_HW_ERROR(NotSupported) << "Frame summation not possible "
+				   << "with IntTrigMult";
+    bool continuous = isContinuous();
+    if(!continuous && m_decimation_policy == Decimation::FirstAfterPeriod)
+      THROW_HW_ERROR(NotSupported) << "Periodic decimation only possible "
+				   << "in continuous acquisition";
+    if(trig_mode == IntTrigMult && m_decimation_policy == Decimation::EveryNth)
+      THROW_HW_ERROR(NotSupported) << "Decimation not possible "
+				   << "with IntTrigMult";
+    m_cam.setContinuous(continuous);
+    if(continuous)
+      m_cam.setNbImagesInSequence(m_cam.continuousSequenceSize());
+    else
+      {
+	int nb_frames = (trig_mode == IntTrigMult)?1:m_nb_frames;
+	int nb_decimated = m_decimation_policy == Decimation::EveryNth ?
+	  m_decimation_every_nth : 1;
+	m_cam.setNbImagesInSequence(nb_frames * m_nb_frames_summed *
+				    nb_decimated);
+      }
+
+}
+
+/*******************************************************************
+ * \brief RoiCtrlObj constructor
+ *******************************************************************/
+
+RoiCtrlObj::RoiCtrlObj(Ingest& ingest,const SavingCtrlObj& saving)
+  : m_ingest(ingest),
+    m_saving(saving)
+{
+    DEB_CONSTRUCTOR();
+}
+
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+RoiCtrlObj::~RoiCtrlObj()
+{
+    DEB_DESTRUCTOR();
+}
+
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void RoiCtrlObj::checkRoi(const Roi& set_roi, Roi& hw_roi)
+{
+    DEB_MEMBER_FUNCT();
+    if(m_saving.isActive())
+      hw_roi = Roi();
+    else
+      m_ingest.checkRoi(set_roi,hw_roi);
+}
+
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void RoiCtrlObj::setRoi(const Roi& set_roi)
+{
+    DEB_MEMBER_FUNCT();
+    m_ingest.setRoi(m_saving.isActive() ? Roi() : set_roi);
+}
+
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void RoiCtrlObj::getRoi(Roi& hw_roi)
+{
+    DEB_MEMBER_FUNCT();
+    m_ingest.getRoi(hw_roi);
+}
+/*******************************************************************
+ * \brief BinCtrlObj constructor
+ *******************************************************************/
+
+BinCtrlObj::BinCtrlObj(Ingest& ingest,const SavingCtrlObj& saving)
+  : m_ingest(ingest),
+    m_saving(saving)
+{
+    DEB_CONSTRUCTOR();
+}
+
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+BinCtrlObj::~BinCtrlObj()
+{
+    DEB_DESTRUCTOR();
+}
+
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void BinCtrlObj::setBin(const Bin& bin)
+{
+    DEB_MEMBER_FUNCT();
+    m_ingest.setBin(m_saving.isActive() ? Bin(1,1) : bin);
+}
 
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void BinCtrlObj::getBin(Bin& bin)
+{
+    DEB_MEMBER_FUNCT();
+    m_ingest.getBin(bin);
+}
+
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void BinCtrlObj::checkBin(Bin& bin)
+{
+    DEB_MEMBER_FUNCT();
+    if(m_saving.isActive())
+      bin = Bin(1,1);
+    else
+      m_ingest.checkBin(bin);
 }
 /*****************************************************************************
 			  Memory map manager
@@ -382,8 +610,11 @@ class _MmapManager : public HwBufferCtrlObj::Callback
   typedef std::pair<void*,long> AddressNSize;
   typedef std::map<void*,AddressNSize> Data2BaseNSize;
   typedef std::multiset<void *> BufferList;
+  typedef std::map<int,std::pair<void*,FrameDim> > Frame2DataNDim;
+  typedef std::map<void*,int> Data2Frame;
 public:
-  _MmapManager() : HwBufferCtrlObj::Callback() {}
+  _MmapManager(Reclaimer& reclaimer) :
+    HwBufferCtrlObj::Callback(),m_reclaimer(reclaimer) {}
   virtual void map(void* address)
   {
     DEB_MEMBER_FUNCT();
@@ -403,9 +634,10 @@ public:
     m_buffer_in_use.erase(it++);
     if(it == m_buffer_in_use.end() || *it != address)
       {
-	Data2BaseNSize::iterator mmap_info = m_data_2_base_n_size.find(address);
-	munmap(mmap_info->second.first,mmap_info->second.second);
-	m_data_2_base_n_size.erase(mmap_info);
+	if(m_pinned.count(address))
+	  m_released.insert(address); // freed with the last view
+	else
+	  _release(address);
       }
   }
   virtual void releaseAll()
@@ -414,40 +646,223 @@ public:
 
     AutoMutex lock(m_mutex);
     for(Data2BaseNSize::iterator mmap_info = m_data_2_base_n_size.begin();
-	mmap_info != m_data_2_base_n_size.end();++mmap_info)
-      munmap(mmap_info->second.first,mmap_info->second.second);
-    m_data_2_base_n_size.clear();
+	mmap_info != m_data_2_base_n_size.end();)
+      {
+	void* address = (mmap_info++)->first;
+	if(m_pinned.count(address))
+	  m_released.insert(address);
+	else
+	  _release(address);
+      }
     m_buffer_in_use.clear();
   }
 
-  void register_new_mmap(void *mmap_mem_base,
+  void register_new_mmap(int frame_nb,const FrameDim& frame_dim,
+			 void *mmap_mem_base,
 			 void *aDataBuffer,long length)
   {
     AutoMutex lock(m_mutex);
     m_data_2_base_n_size[aDataBuffer] = AddressNSize(mmap_mem_base,length);
+    _register_frame(frame_nb,frame_dim,aDataBuffer);
+  }
+  /** register a buffer allocated with posix_memalign
+      (transformed frame), it will be freed instead of unmapped.
+  */
+  void register_new_buffer(int frame_nb,const FrameDim& frame_dim,
+			   void *aDataBuffer)
+  {
+    AutoMutex lock(m_mutex);
+    m_data_2_base_n_size[aDataBuffer] = AddressNSize(aDataBuffer,0);
+    _register_frame(frame_nb,frame_dim,aDataBuffer);
+  }
+  /** keep a frame still held by Lima for a python view,
+      false if it's no more available.
+  */
+  bool pin(int frame_nb,void*& address,FrameDim& frame_dim)
+  {
+    AutoMutex lock(m_mutex);
+    Frame2DataNDim::iterator frame = m_frame_2_data_n_dim.find(frame_nb);
+    if(frame == m_frame_2_data_n_dim.end())
+      return false;
+    address = frame->second.first;
+    frame_dim = frame->second.second;
+    m_pinned.insert(address);
+    return true;
+  }
+  void unpin(void* address)
+  {
+    AutoMutex lock(m_mutex);
+    BufferList::iterator it = m_pinned.find(address);
+    if(it == m_pinned.end())
+      return;
+    m_pinned.erase(it);
+    if(!m_pinned.count(address) && m_released.erase(address))
+      _release(address);
   }
   
 private:
+  void _register_frame(int frame_nb,const FrameDim& frame_dim,void* address)
+  {
+    m_frame_2_data_n_dim[frame_nb] = std::make_pair(address,frame_dim);
+    m_data_2_frame[address] = frame_nb;
+  }
+  // free the buffer and forget its frame (lock held)
+  void _release(void* address)
+  {
+    Data2BaseNSize::iterator mmap_info = m_data_2_base_n_size.find(address);
+    if(mmap_info == m_data_2_base_n_size.end())
+      return;
+    _free(mmap_info->second);
+    m_data_2_base_n_size.erase(mmap_info);
+
+    Data2Frame::iterator frame_nb = m_data_2_frame.find(address);
+    if(frame_nb == m_data_2_frame.end())
+      return;
+    // the frame number may be reused by a new acquisition
+    Frame2DataNDim::iterator frame = m_frame_2_data_n_dim.find(frame_nb->second);
+    if(frame != m_frame_2_data_n_dim.end() && frame->second.first == address)
+      m_frame_2_data_n_dim.erase(frame);
+    m_data_2_frame.erase(frame_nb);
+  }
+  // munmap and free are done by the reclaimer thread
+  void _free(const AddressNSize& info)
+  {
+    if(info.second)
+      m_reclaimer.unmap(info.first,info.second);
+    else
+      m_reclaimer.free(info.first);
+  }
+
+  Reclaimer&		m_reclaimer;
   Mutex			m_mutex;
   Data2BaseNSize	m_data_2_base_n_size;
   BufferList		m_buffer_in_use;
+  Frame2DataNDim	m_frame_2_data_n_dim;
+  Data2Frame		m_data_2_frame;
+  BufferList		m_pinned;	///< python views
+  std::set<void*>	m_released;	///< released by Lima, still pinned
 };
 
 /*******************************************************************
  * \brief Interface::_BufferCallback
+ *
+ * When each camserver file is one Lima frame, camserver writes the
+ * files with Lima's pattern and they are read when Lima's directory
+ * event gives them. With summation, decimation, roi counters, sparse
+ * frames or in continuous, camserver writes raw files (RAW_FILE_PATTERN) taken in order by the
+ * plugin own directory event: each raw file is read and removed at
+ * once, and a completed frame is announced to Lima with an empty file
+ * of Lima's pattern. So Lima is only called for the frames it gets.
+ * With roi counters or sparse frames, Lima gets no frame and the
+ * acquired frames are the ones counted by the plugin.
  *******************************************************************/
 class Interface::_BufferCallback : public HwTmpfsBufferMgr::Callback
 {
   DEB_CLASS_NAMESPC(DebModCamera, "_BufferCallback", "Pilatus");
+
+  class _RawFileCallback : public DirectoryEvent::Callback
+  {
+  public:
+    _RawFileCallback(_BufferCallback& cbk) : m_cbk(cbk) {}
+  protected:
+    virtual ContinueFlag nextFileExpected(int file_number,
+					  const char* full_path,
+					  int& next_file_number_expected) throw()
+    {
+      // camserver file names wrap on the ring
+      int ring_size = m_cbk.m_file_ring_size;
+      next_file_number_expected = ring_size ?
+	(file_number + 1) % ring_size : file_number + 1;
+      try
+	{
+	  return m_cbk._newRawFile(full_path) ? CONTINUE : STOP;
+	}
+      catch(...)
+	{
+	  return STOP;
+	}
+    }
+    virtual ContinueFlag newFile(int,const char*) throw()
+    {
+      return CONTINUE;
+    }
+  private:
+    _BufferCallback& m_cbk;
+  };
+  friend class _RawFileCallback;
+  typedef std::map<int,IngestWorkers::Result> Frame2Result;
 public:
-  _BufferCallback(Interface& hwInterface) : m_interface(hwInterface) {}
+  _BufferCallback(Interface& hwInterface) :
+    m_interface(hwInterface),
+    m_mmap_manager(hwInterface.m_reclaimer),
+    m_raw_cbk(*this),
+    m_raw_event(true,m_raw_cbk),
+    m_lima_frames(true),
+    m_raw_files(false),
+    m_nb_raw_files(0),
+    m_nb_frames_counted(0),
+    m_sum_buffer(NULL),
+    m_file_ring_size(0),
+    m_frame_kept(true),
+    m_frame_nb(-1)
+  {
+    m_raw_event.watch_moved_to();
+  }
+  virtual ~_BufferCallback()
+  {
+    m_raw_event.stop();
+    _freeSumBuffer();
+    _freeAnnounced();
+  }
 
   virtual void prepare(const DirectoryEvent::Parameters &params)
   {
     DEB_MEMBER_FUNCT();
 
+    _freeSumBuffer();
+    _freeAnnounced();
+
+    const Ingest& ingest = m_interface.m_ingest;
+    // a camserver file is one Lima frame, else it's a raw file
+    m_lima_frames = !m_interface.m_roi_counters.isActive() &&
+      !m_interface.m_sparse_frames.isActive();
+    // in continuous, camserver file indices wrap on the ring
+    m_file_ring_size = m_interface.m_sync.isContinuous() ?
+      m_interface.m_cam.fileRingSize() : 0;
+    m_raw_files = !m_lima_frames || ingest.nbFramesSummed() > 1 ||
+      m_interface.m_decimation.isActive() || m_file_ring_size;
+
     m_interface.m_cam.setImgpath(params.watch_path);
-    m_interface.m_cam.setFileName(params.file_pattern);
+    m_interface.m_cam.setFileName(m_raw_files ? RAW_FILE_PATTERN :
+				  params.file_pattern.c_str());
+    m_watch_path = params.watch_path;
+    m_file_pattern = params.file_pattern;
+
+    // workers ingest the frame only when it's one file, one frame
+    FrameDim anImageDim;
+    getFrameDim(anImageDim);
+    FrameDim aRawDim(ingest.detectorSize(),anImageDim.getImageType());
+    bool process = !ingest.isPassThrough() && !m_raw_files;
+    m_interface.m_decimation.prepare();
+    m_nb_raw_files = 0;
+    m_nb_frames_counted = 0;
+    m_frame_kept = true;
+    m_frame_nb = -1;
+
+    _removeRawFiles();
+    if(m_raw_files)
+      {
+	DirectoryEvent::Parameters raw_params;
+	raw_params.watch_path = params.watch_path;
+	raw_params.file_pattern = RAW_FILE_PATTERN;
+	raw_params.next_file_number_expected = 0;
+	m_raw_event.prepare(raw_params);
+      }
+
+    m_interface.m_ingest_workers.prepare(params.watch_path,params.file_pattern,
+					 DECTRIS_EDF_OFFSET,
+					 DECTRIS_EDF_OFFSET + aRawDim.getMemSize(),
+					 anImageDim.getMemSize(),process);
   }
 
   virtual bool getFrameInfo(int image_number,const char* full_path,
@@ -458,53 +873,105 @@ public:
 
     FrameDim anImageDim;
     getFrameDim(anImageDim);
-    long memSize = anImageDim.getMemSize();
-
-    int fd = open(full_path,O_RDONLY);
-    if(fd < 0)
+    FrameDim aRawDim(m_interface.m_ingest.detectorSize(),
+		     anImageDim.getImageType());
+    long aMapLength = DECTRIS_EDF_OFFSET + aRawDim.getMemSize();
+
+    const Ingest& ingest = m_interface.m_ingest;
+    if(from == HwFileEventCallbackHelper::OnDemand &&
+       ingest.nbFramesSummed() > 1)
+      THROW_HW_ERROR(Error) << "Summed image can't be read again";
+    if(from == HwFileEventCallbackHelper::OnDemand &&
+       m_interface.m_decimation.isActive())
+      THROW_HW_ERROR(Error) << "Decimated image can't be read again";
+    // raw files are removed once read
+    if(from == HwFileEventCallbackHelper::OnDemand && m_raw_files)
+      THROW_HW_ERROR(Error) << "Image is no more available";
+
+    IngestWorkers::Result aReadAhead;
+    bool aTaken;
+    if(m_raw_files)
       {
-	if(from == HwFileEventCallbackHelper::OnDemand)
-	  THROW_HW_ERROR(Error) << "Image is no more available";
-	else
+	// the frame was read from the raw files, the file is empty
+	aTaken = _takeAnnounced(image_number,aReadAhead);
+	if(!aTaken)
 	  {
 	    m_interface.m_cam.errorStopAcquisition();
-	    THROW_HW_ERROR(Error) << "Can't open file:" << DEB_VAR1(full_path);
+	    THROW_HW_ERROR(Error) << "Frame not announced:"
+				  << DEB_VAR1(image_number);
 	  }
+	m_interface.m_reclaimer.unlink(full_path);
       }
-    void* mmap_mem_base = mmap(NULL,DECTRIS_EDF_OFFSET + memSize,
-			  PROT_READ,MAP_SHARED,fd,0);
-
-    close(fd);
-
-    if(mmap_mem_base == MAP_FAILED)
+    else
       {
-	m_interface.m_cam.errorStopAcquisition();
-	THROW_HW_ERROR(Error) << "Problem to read image:" << DEB_VAR1(full_path);
+	if(from != HwFileEventCallbackHelper::OnDemand)
+	  m_interface.m_placement.applyToEventThread();
+
+	// files are taken in order, workers may have read this one
+	aTaken = from != HwFileEventCallbackHelper::OnDemand &&
+	  m_interface.m_ingest_workers.take(image_number,
+					    m_interface.m_cam.nbImagesInSequence(),
+					    aReadAhead);
       }
+
+    void* mmap_mem_base;
+    if(aTaken)
+      mmap_mem_base = aReadAhead.map_base;
+    else
+      mmap_mem_base = _mapFile(full_path,aMapLength,from);
     
-    void* aDataBuffer = (char*)mmap_mem_base + DECTRIS_EDF_OFFSET;
-    frame_info = HwFrameInfoType(image_number,aDataBuffer,&anImageDim,
-				 Timestamp(),0,
-				 HwFrameInfoType::Managed);
-    m_mmap_manager.register_new_mmap(mmap_mem_base,
-				     aDataBuffer,DECTRIS_EDF_OFFSET + memSize);
-    bool aReturnFlag = true;
-    if(m_interface.m_buffer.getNbOfFramePending() > 32)
+    void* aDataBuffer = mmap_mem_base ?
+      (char*)mmap_mem_base + DECTRIS_EDF_OFFSET : NULL;
+    bool aMapped = false;	// aDataBuffer is still in the file mapping
+    Reclaimer& reclaimer = m_interface.m_reclaimer;
+    if(!mmap_mem_base)
+      aDataBuffer = aReadAhead.buffer; // already ingested
+    else if(ingest.isPassThrough())
+      aMapped = true;
+    else
       {
-	m_interface.m_cam.errorStopAcquisition();
-	aReturnFlag = false;
+	// only the needed part of the raw frame is read,
+	// file is unmapped as soon as it's copied
+	aDataBuffer = _allocateFrame(mmap_mem_base,aMapLength,
+				    anImageDim.getMemSize());
+	ingest.process((const int*)((char*)mmap_mem_base + DECTRIS_EDF_OFFSET),
+		       (int*)aDataBuffer);
+	reclaimer.unmap(mmap_mem_base,aMapLength);
       }
+
+    int frame_nb = image_number;
+    const int* aFrame = (const int*)aDataBuffer;
+    const Size& aSize = anImageDim.getSize();
+    bool aNewFrame = from != HwFileEventCallbackHelper::OnDemand;
+
+    if(aNewFrame && frame_nb == 0)
+      m_interface.m_placement.sampleFrame(mmap_mem_base,
+					  aMapped ? NULL : aDataBuffer);
+
+    Statistics& statistics = m_interface.m_statistics;
+    if(aNewFrame && statistics.isActive())
+      statistics.compute(frame_nb,aFrame,
+			 long(aSize.getWidth()) * aSize.getHeight());
+
+    if(aMapped)
+      m_mmap_manager.register_new_mmap(frame_nb,anImageDim,
+				       mmap_mem_base,aDataBuffer,
+				       aMapLength);
     else
-      aReturnFlag = (image_number + 1) != m_interface.m_cam.nbImagesInSequence();
+      m_mmap_manager.register_new_buffer(frame_nb,anImageDim,aDataBuffer);
 
-    return aReturnFlag;
+    frame_info = HwFrameInfoType(frame_nb,aDataBuffer,
+				 &anImageDim,Timestamp(),0,
+				 HwFrameInfoType::Managed);
+
+    return _continueFlag(image_number);
   }
   virtual void getFrameDim(FrameDim& frame_dim)
   {
     DEB_MEMBER_FUNCT();
 
     Size current_size;
-    m_interface.m_det_info.getDetectorImageSize(current_size);
+    m_interface.m_ingest.getImageSize(current_size);
     ImageType current_image_type;
     m_interface.m_det_info.getCurrImageType(current_image_type);
     
@@ -515,34 +982,352 @@ public:
   {
     return &m_mmap_manager;
   }
+  _MmapManager& mmapManager() {return m_mmap_manager;}
+
+  // false with roi counters or sparse frames,
+  // Lima's directory event isn't started
+  bool hasLimaFrames() const {return m_lima_frames;}
+  // raw files are taken from the start of the acquisition
+  void start()
+  {
+    if(m_raw_files)
+      m_raw_event.start();
+  }
+  void stop()
+  {
+    if(m_raw_files)
+      m_raw_event.stop();
+  }
+  bool isStopped()
+  {
+    return m_lima_frames ? m_interface.m_buffer.isStopped() :
+      m_raw_event.isStopped();
+  }
+  // frames given to Lima, or counted by the plugin without Lima frame
+  int nbAcquiredFrames()
+  {
+    if(m_lima_frames)
+      return m_interface.m_buffer.getLastAcquiredFrame() + 1;
+
+    AutoMutex lock(m_frames_mutex);
+    return m_nb_frames_counted;
+  }
 private:
-  Interface&	m_interface;
-  _MmapManager	m_mmap_manager;
-};
+  void _freeSumBuffer()
+  {
+    free(m_sum_buffer);
+    m_sum_buffer = NULL;
+  }
+  // mapping of the raw frame file
+  void* _mapFile(const char* full_path,long map_length,
+		 HwFileEventCallbackHelper::CallFrom from)
+  {
+    DEB_MEMBER_FUNCT();
 
-/*******************************************************************
- * \brief Hw Interface constructor
- *******************************************************************/
+    int fd = open(full_path,O_RDONLY);
+    if(fd < 0)
+      {
+	if(from == HwFileEventCallbackHelper::OnDemand)
+	  THROW_HW_ERROR(Error) << "Image is no more available";
+	else
+	  {
+	    m_interface.m_cam.errorStopAcquisition();
+	    THROW_HW_ERROR(Error) << "Can't open file:" << DEB_VAR1(full_path);
+	  }
+      }
+    void* mmap_mem_base = mmap(NULL,map_length,PROT_READ,MAP_SHARED,fd,0);
 
-Interface::Interface(Camera& cam,const DetInfoCtrlObj::Info* info)
-            :   m_cam(cam),
-                m_det_info(info),
-		m_buffer_cbk(new Interface::_BufferCallback(*this)),
-                m_buffer(WATCH_PATH,FILE_PATTERN,
-			 *m_buffer_cbk),
-                m_sync(cam,m_det_info),
-		m_saving(cam)
-{
-    DEB_CONSTRUCTOR();
+    close(fd);
 
-    HwDetInfoCtrlObj *det_info = &m_det_info;
-    m_cap_list.push_back(HwCap(det_info));
+    if(mmap_mem_base == MAP_FAILED)
+      {
+	m_interface.m_cam.errorStopAcquisition();
+	THROW_HW_ERROR(Error) << "Problem to read image:" << DEB_VAR1(full_path);
+      }
+    return mmap_mem_base;
+  }
+  // new frame buffer, the file mapping is given back on error
+  void* _allocateFrame(void* mmap_mem_base,long map_length,long frame_size)
+  {
+    DEB_MEMBER_FUNCT();
 
-    HwBufferCtrlObj *buffer = &m_buffer;
-    m_cap_list.push_back(HwCap(buffer));
+    void* aFrameBuffer;
+    if(Placement::allocateFrame(&aFrameBuffer,frame_size))
+      {
+	munmap(mmap_mem_base,map_length);
+	m_interface.m_cam.errorStopAcquisition();
+	THROW_HW_ERROR(Error) << "Can't allocate memory";
+      }
+    m_interface.m_placement.bindMemory(aFrameBuffer,frame_size);
+    return aFrameBuffer;
+  }
+  // a camserver raw file, in order. It's removed as soon as it's
+  // read, completed frames are announced to Lima.
+  // False after the last file.
+  bool _newRawFile(const char* full_path)
+  {
+    DEB_MEMBER_FUNCT();
 
-    HwSyncCtrlObj *sync = &m_sync;
-    m_cap_list.push_back(HwCap(sync));
+    m_interface.m_placement.applyToEventThread();
+
+    const Ingest& ingest = m_interface.m_ingest;
+    Reclaimer& reclaimer = m_interface.m_reclaimer;
+    int nb_summed = ingest.nbFramesSummed();
+    int file_nb = m_nb_raw_files++;
+    bool aContinueFlag = m_file_ring_size ||
+      m_nb_raw_files != m_interface.m_cam.nbImagesInSequence();
+
+    // all the files of a summed frame are kept or discarded
+    if(file_nb % nb_summed == 0)
+      m_frame_kept = m_interface.m_decimation.select(m_frame_nb);
+    if(!m_frame_kept)
+      {
+	// never mapped
+	_removeRawFile(full_path);
+	return aContinueFlag;
+      }
+
+    FrameDim anImageDim;
+    getFrameDim(anImageDim);
+    FrameDim aRawDim(ingest.detectorSize(),anImageDim.getImageType());
+    long aMapLength = DECTRIS_EDF_OFFSET + aRawDim.getMemSize();
+    void* mmap_mem_base = _mapFile(full_path,aMapLength,
+				   HwFileEventCallbackHelper::OnEvent);
+    const int* aRawBuffer = (const int*)((char*)mmap_mem_base +
+					 DECTRIS_EDF_OFFSET);
+
+    RoiCounters& roi_counters = m_interface.m_roi_counters;
+    if(roi_counters.isActive())
+      {
+	// only roi counters are kept
+	roi_counters.compute(m_frame_nb,aRawBuffer);
+	reclaimer.unmap(mmap_mem_base,aMapLength);
+	_removeRawFile(full_path);
+	_countFrame();
+	return aContinueFlag;
+      }
+
+    IngestWorkers::Result aFrame;
+    aFrame.map_base = NULL;
+    aFrame.map_length = 0;
+    aFrame.buffer = NULL;
+    if(nb_summed == 1 && ingest.isPassThrough())
+      {
+	// the mapping is the frame, it stays once the file is removed
+	aFrame.map_base = mmap_mem_base;
+	aFrame.map_length = aMapLength;
+      }
+    else
+      {
+	if(file_nb % nb_summed == 0)
+	  {
+	    _freeSumBuffer();
+	    m_sum_buffer = _allocateFrame(mmap_mem_base,aMapLength,
+					 anImageDim.getMemSize());
+	    ingest.process(aRawBuffer,(int*)m_sum_buffer);
+	  }
+	else
+	  ingest.accumulate(aRawBuffer,(int*)m_sum_buffer,m_sum_scratch);
+	reclaimer.unmap(mmap_mem_base,aMapLength);
+      }
+    _removeRawFile(full_path);
+
+    if(file_nb % nb_summed == nb_summed - 1)
+      {
+	aFrame.buffer = m_sum_buffer;
+	m_sum_buffer = NULL;
+	if(m_lima_frames)
+	  _announce(m_frame_nb,aFrame);
+	else
+	  _encodeSparse(m_frame_nb,aFrame);
+      }
+    return aContinueFlag;
+  }
+  // files written by camserver after a stop, on the ring they
+  // would be read as the files of the next acquisition
+  void _removeRawFiles()
+  {
+    DIR* aDir = opendir(m_watch_path.c_str());
+    if(!aDir)
+      return;
+    struct dirent* anEntry;
+    while((anEntry = readdir(aDir)))
+      if(!strncmp(anEntry->d_name,RAW_FILE_PREFIX,sizeof(RAW_FILE_PREFIX) - 1))
+	unlink((m_watch_path + "/" + anEntry->d_name).c_str());
+    closedir(aDir);
+  }
+  // on the ring, the name is soon reused by camserver
+  void _removeRawFile(const char* full_path)
+  {
+    if(m_file_ring_size)
+      unlink(full_path);
+    else
+      m_interface.m_reclaimer.unlink(full_path);
+  }
+  // the frame is given to Lima with an empty file of its pattern,
+  // renamed into place as camserver does
+  void _announce(int frame_nb,const IngestWorkers::Result& frame)
+  {
+    DEB_MEMBER_FUNCT();
+
+    AutoMutex lock(m_frames_mutex);
+    m_announced[frame_nb] = frame;
+    lock.unlock();
+
+    char file_name[256];
+    snprintf(file_name,sizeof(file_name),m_file_pattern.c_str(),frame_nb);
+    std::string path = m_watch_path + "/" + file_name;
+    std::string tmp_path = m_watch_path + "/" + ANNOUNCE_TMP_FILE;
+    int fd = open(tmp_path.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+    if(fd < 0 || close(fd) || rename(tmp_path.c_str(),path.c_str()))
+      {
+	m_interface.m_cam.errorStopAcquisition();
+	THROW_HW_ERROR(Error) << "Can't announce frame:" << DEB_VAR1(path);
+      }
+  }
+  // only the sparse frame is kept
+  void _encodeSparse(int frame_nb,const IngestWorkers::Result& frame)
+  {
+    FrameDim anImageDim;
+    getFrameDim(anImageDim);
+    const Size& aSize = anImageDim.getSize();
+    const int* aFrame = frame.map_base ?
+      (const int*)((char*)frame.map_base + DECTRIS_EDF_OFFSET) :
+      (const int*)frame.buffer;
+
+    if(frame_nb == 0)
+      m_interface.m_placement.sampleFrame(frame.map_base,frame.buffer);
+
+    Statistics& statistics = m_interface.m_statistics;
+    if(statistics.isActive())
+      statistics.compute(frame_nb,aFrame,
+			 long(aSize.getWidth()) * aSize.getHeight());
+    m_interface.m_sparse_frames.encode(frame_nb,aSize,aFrame);
+
+    Reclaimer& reclaimer = m_interface.m_reclaimer;
+    if(frame.map_base)
+      reclaimer.unmap(frame.map_base,frame.map_length);
+    else
+      reclaimer.free(frame.buffer);
+    _countFrame();
+  }
+  bool _takeAnnounced(int frame_nb,IngestWorkers::Result& frame)
+  {
+    AutoMutex lock(m_frames_mutex);
+    Frame2Result::iterator i = m_announced.find(frame_nb);
+    if(i == m_announced.end())
+      return false;
+    frame = i->second;
+    m_announced.erase(i);
+    return true;
+  }
+  void _countFrame()
+  {
+    AutoMutex lock(m_frames_mutex);
+    ++m_nb_frames_counted;
+  }
+  // frames announced but not taken by Lima, i.e after a stop
+  void _freeAnnounced()
+  {
+    AutoMutex lock(m_frames_mutex);
+    for(Frame2Result::iterator i = m_announced.begin();
+	i != m_announced.end();++i)
+      {
+	if(i->second.map_base)
+	  munmap(i->second.map_base,i->second.map_length);
+	free(i->second.buffer);
+
+	char file_name[256];
+	snprintf(file_name,sizeof(file_name),m_file_pattern.c_str(),i->first);
+	unlink((m_watch_path + "/" + file_name).c_str());
+      }
+    m_announced.clear();
+  }
+  // false at the end of the acquisition or if Lima is too late
+  bool _continueFlag(int image_number)
+  {
+    bool aReturnFlag = true;
+    if(m_interface.m_buffer.getNbOfFramePending() > 32)
+      {
+	m_interface.m_cam.errorStopAcquisition();
+	aReturnFlag = false;
+      }
+    else if(m_raw_files)
+      {
+	int nb_frames;
+	m_interface.m_sync.getNbHwFrames(nb_frames);
+	aReturnFlag = m_file_ring_size || (image_number + 1) != nb_frames;
+      }
+    else
+      aReturnFlag = (image_number + 1) != m_interface.m_cam.nbImagesInSequence();
+
+    return aReturnFlag;
+  }
+
+  Interface&	m_interface;
+  _MmapManager	m_mmap_manager;
+  _RawFileCallback m_raw_cbk;
+  DirectoryEvent m_raw_event;	///< camserver raw files
+  bool		m_lima_frames;	///< false with roi counters, sparse
+  bool		m_raw_files;	///< camserver file isn't a Lima frame
+  int		m_nb_raw_files;
+  int		m_nb_frames_counted; ///< without Lima frame
+  void*		m_sum_buffer;	///< frame being summed
+  std::vector<int> m_sum_scratch;
+  int		m_file_ring_size; ///< 0 if not continuous
+  std::string	m_watch_path;
+  std::string	m_file_pattern;
+  bool		m_frame_kept;	///< current summed frame is delivered
+  int		m_frame_nb;	///< Lima frame of the current raw file
+  Mutex		m_frames_mutex;
+  Frame2Result	m_announced;	///< read, waiting for Lima
+};
+
+/*******************************************************************
+ * \brief Hw Interface constructor
+ *******************************************************************/
+
+Interface::Interface(Camera& cam,const DetInfoCtrlObj::Info* info)
+            :   m_cam(cam),
+                m_det_info(info),
+		m_ingest_workers(m_ingest),
+		m_buffer_cbk(new Interface::_BufferCallback(*this)),
+                m_buffer(WATCH_PATH,FILE_PATTERN,
+			 *m_buffer_cbk),
+                m_sync(cam,m_det_info),
+		m_roi(m_ingest,m_saving),
+		m_bin(m_ingest,m_saving),
+		m_saving(cam),
+		m_latency_calibration(cam,WATCH_PATH,FILE_PATTERN)
+{
+    DEB_CONSTRUCTOR();
+
+    ModuleGeometry geometry = m_det_info.getModuleGeometry();
+    m_correction.setDetectorSize(geometry.detectorSize());
+    m_ingest.setGeometry(geometry);
+    m_ingest.setCorrection(&m_correction);
+    m_roi_counters.setDetectorSize(geometry.detectorSize());
+    m_ingest_workers.setPlacement(&m_placement);
+
+    double latency;
+    if(m_latency_calibration.lookup(m_det_info.getModel(),
+				    m_cam.exposure(),latency))
+      m_sync.setMinLatTime(latency);
+
+    HwDetInfoCtrlObj *det_info = &m_det_info;
+    m_cap_list.push_back(HwCap(det_info));
+
+    HwBufferCtrlObj *buffer = &m_buffer;
+    m_cap_list.push_back(HwCap(buffer));
+
+    HwSyncCtrlObj *sync = &m_sync;
+    m_cap_list.push_back(HwCap(sync));
+
+    HwRoiCtrlObj *roi = &m_roi;
+    m_cap_list.push_back(HwCap(roi));
+
+    HwBinCtrlObj *bin = &m_bin;
+    m_cap_list.push_back(HwCap(bin));
 
     HwSavingCtrlObj *saving = &m_saving;
     m_cap_list.push_back(HwCap(saving));
@@ -604,9 +1389,40 @@ void Interface::prepareAcq()
     DEB_MEMBER_FUNCT();
 
     if(m_saving.isActive())
-      m_saving.prepare();
+      {
+	// camserver writes each detector frame in its own file
+	if(m_ingest.nbFramesSummed() > 1 || m_decimation.isActive())
+	  THROW_HW_ERROR(NotSupported) << "Frame summation and decimation "
+				       << "not possible with camserver saving";
+	// roi or binning set before the saving was activated
+	Roi roi;
+	m_ingest.getRoi(roi);
+	if(roi.isActive())
+	  THROW_HW_ERROR(NotSupported) << "Hardware roi not possible with "
+				       << "camserver saving";
+	Bin bin;
+	m_ingest.getBin(bin);
+	if(!bin.isOne())
+	  THROW_HW_ERROR(NotSupported) << "Hardware binning not possible "
+				       << "with camserver saving";
+	m_saving.prepare();
+      }
     else
-      m_buffer.prepare();
+      {
+	// roi counters are computed on each raw frame
+	if(m_roi_counters.isActive() &&
+	   (m_ingest.nbFramesSummed() > 1 || m_decimation.isActive()))
+	  THROW_HW_ERROR(NotSupported) << "Roi counters not possible with "
+				       << "frame summation or decimation";
+	// previous acquisition memory is given back first
+	m_reclaimer.flush();
+	m_correction.prepare(m_cam.exposure(),
+			     m_statistics.saturationThreshold());
+	m_statistics.reset();
+	m_roi_counters.prepare();
+	m_sparse_frames.prepare();
+	m_buffer.prepare();
+      }
     m_sync.prepareAcq();
 
 }
@@ -621,7 +1437,11 @@ void Interface::startAcq()
     if(m_saving.isActive())
       m_saving.start();
     else
-      m_buffer.start();
+      {
+	if(m_buffer_cbk->hasLimaFrames())
+	  m_buffer.start();
+	m_buffer_cbk->start();
+      }
 
     m_cam.startAcquisition();
 }
@@ -636,7 +1456,11 @@ void Interface::stopAcq()
     if(m_saving.isActive())
       m_saving.stop();
     else
-      m_buffer.stop();
+      {
+	m_buffer.stop();
+	m_buffer_cbk->stop();
+	m_ingest_workers.release();
+      }
 
     m_cam.stopAcquisition();
 }
@@ -657,7 +1481,7 @@ void Interface::getStatus(StatusType& status)
 	  {
 	    int nbFrames;
 	    m_sync.getNbHwFrames(nbFrames);
-	    if(m_buffer.isStopped())
+	    if(m_buffer_cbk->isStopped())
 	      status.acq = AcqReady;
 	    else
 	      status.acq = getNbHwAcquiredFrames() >= nbFrames ? AcqReady : AcqRunning;
@@ -686,7 +1510,7 @@ void Interface::getStatus(StatusType& status)
 int Interface::getNbHwAcquiredFrames()
 {
     DEB_MEMBER_FUNCT();
-    int acq_frames = m_buffer.getLastAcquiredFrame()+1;
+    int acq_frames = m_buffer_cbk->nbAcquiredFrames();
     return acq_frames;
 }
 
@@ -729,6 +1553,620 @@ void Interface::sendAnyCommand(const std::string& str)
     m_cam.sendAnyCommand(str);
 }
 
+//-----------------------------------------------------
+// drop inter-module gaps from the delivered frames
+//-----------------------------------------------------
+void Interface::setGapCompaction(bool flag)
+{
+    DEB_MEMBER_FUNCT();
+    m_ingest.setGapCompaction(flag);
+    m_det_info.setGapCompaction(flag);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+bool Interface::getGapCompaction() const
+{
+    return m_ingest.gapCompaction();
+}
+//-----------------------------------------------------
+// sum nb_frames consecutive detector frames in the plugin,
+// the detector runs nb_frames times more images.
+// Not with camserver saving.
+//-----------------------------------------------------
+void Interface::setNbFramesSummed(int nb_frames)
+{
+    DEB_MEMBER_FUNCT();
+    m_ingest.setNbFramesSummed(nb_frames);
+    m_sync.setNbFramesSummed(nb_frames);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+int Interface::getNbFramesSummed() const
+{
+    return m_ingest.nbFramesSummed();
+}
+//-----------------------------------------------------
+// mask (bad pixels) applied at ingest, empty to disable
+//-----------------------------------------------------
+void Interface::setMaskFile(const std::string& path)
+{
+    DEB_MEMBER_FUNCT();
+    m_correction.setMaskFile(path);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+const std::string& Interface::getMaskFile() const
+{
+    return m_correction.maskFile();
+}
+//-----------------------------------------------------
+// flat field gains applied at ingest, empty to disable
+//-----------------------------------------------------
+void Interface::setFlatFieldFile(const std::string& path)
+{
+    DEB_MEMBER_FUNCT();
+    m_correction.setFlatFieldFile(path);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+const std::string& Interface::getFlatFieldFile() const
+{
+    return m_correction.flatFieldFile();
+}
+//-----------------------------------------------------
+// count rate correction at ingest, needs the dead time
+//-----------------------------------------------------
+void Interface::setCountRateCorrection(bool flag)
+{
+    DEB_MEMBER_FUNCT();
+    m_correction.setCountRateCorrection(flag);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+bool Interface::getCountRateCorrection() const
+{
+    return m_correction.countRateCorrection();
+}
+//-----------------------------------------------------
+// detector dead time (tau) in second
+//-----------------------------------------------------
+void Interface::setDeadTime(double tau)
+{
+    DEB_MEMBER_FUNCT();
+    m_correction.setDeadTime(tau);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+double Interface::getDeadTime() const
+{
+    return m_correction.deadTime();
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void Interface::setStatisticsActive(bool flag)
+{
+    DEB_MEMBER_FUNCT();
+    m_statistics.setActive(flag);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+bool Interface::getStatisticsActive() const
+{
+    return m_statistics.isActive();
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void Interface::setSaturationThreshold(int threshold)
+{
+    DEB_MEMBER_FUNCT();
+    m_statistics.setSaturationThreshold(threshold);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+int Interface::getSaturationThreshold() const
+{
+    return m_statistics.saturationThreshold();
+}
+//-----------------------------------------------------
+// false if frame is not yet ingested or too old
+//-----------------------------------------------------
+bool Interface::getFrameStatistics(int frame_nb,
+				   Statistics::Result& result) const
+{
+    return m_statistics.get(frame_nb,result);
+}
+//-----------------------------------------------------
+// last ingested frame with statistics, -1 if none
+//-----------------------------------------------------
+int Interface::getLastStatisticsFrameNb() const
+{
+    return m_statistics.lastFrameNb();
+}
+//-----------------------------------------------------
+// in raw detector coordinates
+//-----------------------------------------------------
+void Interface::setRoiCounters(const std::vector<Roi>& rois)
+{
+    DEB_MEMBER_FUNCT();
+    m_roi_counters.setRois(rois);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+const std::vector<Roi>& Interface::getRoiCounters() const
+{
+    return m_roi_counters.rois();
+}
+//-----------------------------------------------------
+// no image is given to Lima while active, nor with frame
+// summation or decimation. Lima image counters don't move:
+// getStatus is ready and getNbHwAcquiredFrames reaches the
+// number of frames once every frame is counted, then the Lima
+// acquisition is ended with stopAcq. In live (no frame number)
+// it runs until stopAcq.
+//-----------------------------------------------------
+void Interface::setRoiCountersMode(bool flag)
+{
+    DEB_MEMBER_FUNCT();
+    m_roi_counters.setActive(flag);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+bool Interface::getRoiCountersMode() const
+{
+    return m_roi_counters.isActive();
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void Interface::setRoiCountersFifoSize(int nb_frames)
+{
+    DEB_MEMBER_FUNCT();
+    m_roi_counters.setFifoSize(nb_frames);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+int Interface::getRoiCountersFifoSize() const
+{
+    return m_roi_counters.fifoSize();
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+int Interface::readRoiCounters(std::vector<int>& frame_nbs,
+			       std::vector<long long>& sums,
+			       int max_nb_frames,double timeout)
+{
+    DEB_MEMBER_FUNCT();
+    return m_roi_counters.readCounters(frame_nbs,sums,max_nb_frames,timeout);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+int Interface::getRoiCountersLostFrames() const
+{
+    return m_roi_counters.nbLostFrames();
+}
+//-----------------------------------------------------
+// no image is given to Lima while active, the acquisition
+// ends as with roi counters (see setRoiCountersMode)
+//-----------------------------------------------------
+void Interface::setSparseMode(bool flag)
+{
+    DEB_MEMBER_FUNCT();
+    m_sparse_frames.setActive(flag);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+bool Interface::getSparseMode() const
+{
+    return m_sparse_frames.isActive();
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void Interface::setSparseFifoSize(int nb_frames)
+{
+    DEB_MEMBER_FUNCT();
+    m_sparse_frames.setFifoSize(nb_frames);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+int Interface::getSparseFifoSize() const
+{
+    return m_sparse_frames.fifoSize();
+}
+//-----------------------------------------------------
+// SparseFrame::decode() gives back the full frame
+//-----------------------------------------------------
+int Interface::readSparseFrames(std::vector<SparseFrame>& frames,
+				int max_nb_frames,double timeout)
+{
+    DEB_MEMBER_FUNCT();
+    return m_sparse_frames.readFrames(frames,max_nb_frames,timeout);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+int Interface::getSparseLostFrames() const
+{
+    return m_sparse_frames.nbLostFrames();
+}
+//-----------------------------------------------------
+// 0 means files are only read by the directory event thread
+//-----------------------------------------------------
+void Interface::setNbIngestWorkers(int nb_workers)
+{
+    DEB_MEMBER_FUNCT();
+    m_ingest_workers.setNbWorkers(nb_workers);
+    _applyWorkerCpus();
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+int Interface::getNbIngestWorkers() const
+{
+    return m_ingest_workers.nbWorkers();
+}
+//-----------------------------------------------------
+// cpu list like "0-7,16-23", empty means all cpus
+//-----------------------------------------------------
+void Interface::setThreadCpus(Placement::ThreadRole role,
+			      const std::string& cpus)
+{
+    DEB_MEMBER_FUNCT();
+    m_placement.setCpus(role,cpus);
+    if(role == Placement::CameraThread)
+      m_placement.applyCpus(role,m_cam.m_thread_id);
+    else if(role == Placement::WorkerThreads)
+      _applyWorkerCpus();
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+const std::string& Interface::getThreadCpus(Placement::ThreadRole role) const
+{
+    return m_placement.cpus(role);
+}
+//-----------------------------------------------------
+// applied to the frame buffers allocated by the plugin
+//-----------------------------------------------------
+void Interface::setMemoryPolicy(Placement::MemoryPolicy policy,
+				const std::string& nodes)
+{
+    DEB_MEMBER_FUNCT();
+    m_placement.setMemoryPolicy(policy,nodes);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+Placement::MemoryPolicy Interface::getMemoryPolicy() const
+{
+    return m_placement.memoryPolicy();
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+const std::string& Interface::getMemoryNodes() const
+{
+    return m_placement.memoryNodes();
+}
+//-----------------------------------------------------
+// effective cpus of each thread and nodes of the first frame
+//-----------------------------------------------------
+std::string Interface::getPlacementReport() const
+{
+    std::vector<pthread_t> worker_threads;
+    m_ingest_workers.getThreadIds(worker_threads);
+    return m_placement.report(m_cam.m_thread_id,worker_threads);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void Interface::_applyWorkerCpus()
+{
+    std::vector<pthread_t> worker_threads;
+    m_ingest_workers.getThreadIds(worker_threads);
+    for(std::vector<pthread_t>::iterator i = worker_threads.begin();
+	i != worker_threads.end();++i)
+      m_placement.applyCpus(Placement::WorkerThreads,*i);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+ModelTiming Interface::getModelTiming() const
+{
+    return m_sync.getModelTiming();
+}
+//-----------------------------------------------------
+// fastest legal period for exposure with the current latency
+//-----------------------------------------------------
+double Interface::getExposurePeriod(double exposure) const
+{
+    return m_sync.getExposurePeriod(exposure);
+}
+//-----------------------------------------------------
+// shortest latency accepted by camserver for exposure
+// with the current trigger mode, it's used by the sync
+//-----------------------------------------------------
+double Interface::calibrateLatency(double exposure,bool verify)
+{
+    DEB_MEMBER_FUNCT();
+    double latency = m_latency_calibration.calibrate(m_det_info.getModel(),
+						     exposure,verify);
+    m_sync.setMinLatTime(latency);
+    return latency;
+}
+//-----------------------------------------------------
+// false if never calibrated for this model/version/trigger mode
+//-----------------------------------------------------
+bool Interface::loadLatencyCalibration(double exposure)
+{
+    DEB_MEMBER_FUNCT();
+    double latency;
+    bool found = m_latency_calibration.lookup(m_det_info.getModel(),
+					      exposure,latency);
+    if(found)
+      m_sync.setMinLatTime(latency);
+    return found;
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void Interface::setLatencyCacheFile(const std::string& path)
+{
+    DEB_MEMBER_FUNCT();
+    m_latency_calibration.setCacheFile(path);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+const std::string& Interface::getLatencyCacheFile() const
+{
+    return m_latency_calibration.cacheFile();
+}
+//-----------------------------------------------------
+// file names of a continuous (live) acquisition
+//-----------------------------------------------------
+void Interface::setFileRingSize(int nb_files)
+{
+    DEB_MEMBER_FUNCT();
+    m_cam.setFileRingSize(nb_files);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+int Interface::getFileRingSize() const
+{
+    return m_cam.fileRingSize();
+}
+//-----------------------------------------------------
+// live view: only one frame out of nb_frames is given to Lima,
+// the detector runs nb_frames times more images. 1 disables.
+// Not with camserver saving.
+//-----------------------------------------------------
+void Interface::setDecimationEveryNth(int nb_frames)
+{
+    DEB_MEMBER_FUNCT();
+    m_decimation.setEveryNth(nb_frames);
+    m_sync.setDecimation(m_decimation.policy(),m_decimation.everyNth());
+}
+//-----------------------------------------------------
+// live view: the first frame handled once the period since
+// the last delivered one is over is given to Lima (continuous
+// acquisition only). 0 disables.
+//-----------------------------------------------------
+void Interface::setDecimationPeriod(double period)
+{
+    DEB_MEMBER_FUNCT();
+    m_decimation.setPeriod(period);
+    m_sync.setDecimation(m_decimation.policy(),m_decimation.everyNth());
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+Decimation::Policy Interface::getDecimationPolicy() const
+{
+    return m_decimation.policy();
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+int Interface::getDecimationEveryNth() const
+{
+    return m_decimation.everyNth();
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+double Interface::getDecimationPeriod() const
+{
+    return m_decimation.period();
+}
+//-----------------------------------------------------
+// saving mode: files are moved from the ramdisk to path
+// as soon as camserver closes them. Empty to disable.
+//-----------------------------------------------------
+void Interface::setOffloadDestination(const std::string& path)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving.offload().setDestination(path);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+const std::string& Interface::getOffloadDestination() const
+{
+    return m_saving.offload().destination();
+}
+//-----------------------------------------------------
+// number of files copied in parallel
+//-----------------------------------------------------
+void Interface::setOffloadNbCopies(int nb_copies)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving.offload().setNbCopies(nb_copies);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+int Interface::getOffloadNbCopies() const
+{
+    return m_saving.offload().nbCopies();
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void Interface::getOffloadStats(Offload::Stats& stats) const
+{
+    m_saving.offload().getStats(stats);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void Interface::resetOffloadStats()
+{
+    m_saving.offload().resetStats();
+}
+//-----------------------------------------------------
+// wait until the files already closed are offloaded,
+// false on timeout
+//-----------------------------------------------------
+bool Interface::waitOffload(double timeout)
+{
+    DEB_MEMBER_FUNCT();
+    return m_saving.offload().wait(timeout);
+}
+//-----------------------------------------------------
+// common header changes are merged and sent in a single
+// command when the acquisition is prepared
+//-----------------------------------------------------
+void Interface::setHeaderQueued(bool flag)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving.setHeaderQueued(flag);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+bool Interface::getHeaderQueued() const
+{
+    return m_saving.isHeaderQueued();
+}
+//-----------------------------------------------------
+// next common header is sent in full
+//-----------------------------------------------------
+void Interface::resetHeaderCache()
+{
+    DEB_MEMBER_FUNCT();
+    m_saving.resetHeaderCache();
+}
+//-----------------------------------------------------
+// saving mode: index of the series (<prefix>.index in the
+// saving directory) filled as camserver closes the files
+//-----------------------------------------------------
+void Interface::setFrameIndexActive(bool flag)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving.setFrameIndexActive(flag);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+bool Interface::getFrameIndexActive() const
+{
+    return m_saving.isFrameIndexActive();
+}
+//-----------------------------------------------------
+// empty until a series is prepared
+//-----------------------------------------------------
+const std::string& Interface::getFrameIndexPath() const
+{
+    return m_saving.frameIndex().path();
+}
+//-----------------------------------------------------
+// saving mode: bytes of decoded frames kept for readFrame,
+// 0 disables
+//-----------------------------------------------------
+void Interface::setFrameCacheSize(long long nb_bytes)
+{
+    DEB_MEMBER_FUNCT();
+    m_saving.frameCache().setBudget(nb_bytes);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+long long Interface::getFrameCacheSize() const
+{
+    return m_saving.frameCache().budget();
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void Interface::getFrameCacheStats(FrameCache::Stats& stats) const
+{
+    m_saving.frameCache().getStats(stats);
+}
+//-----------------------------------------------------
+//
+//-----------------------------------------------------
+void Interface::clearFrameCache()
+{
+    DEB_MEMBER_FUNCT();
+    m_saving.frameCache().clear();
+}
+//-----------------------------------------------------
+// views on the mapped frames
+//-----------------------------------------------------
+bool Interface::_pinFrame(int frame_nb,void*& data,FrameDim& frame_dim)
+{
+    return m_buffer_cbk->mmapManager().pin(frame_nb,data,frame_dim);
+}
+
+void Interface::_unpinFrame(void* data)
+{
+    m_buffer_cbk->mmapManager().unpin(data);
+}
+
+FrameView::FrameView(Interface& i,int frame_nb) :
+    m_interface(i),
+    m_frame_nb(frame_nb),
+    m_data(NULL)
+{
+    DEB_CONSTRUCTOR();
+    DEB_PARAM() << DEB_VAR1(frame_nb);
+
+    if(!m_interface._pinFrame(frame_nb,m_data,m_frame_dim))
+      THROW_HW_ERROR(Error) << "Frame " << frame_nb << " is not mapped";
+}
+
+FrameView::~FrameView()
+{
+    DEB_DESTRUCTOR();
+    m_interface._unpinFrame(m_data);
+}
+//-----------------------------------------------------
+// module map to restore the detector geometry
+//-----------------------------------------------------
+const ModuleGeometry& Interface::getModuleGeometry() const
+{
+    return m_ingest.geometry();
+}
+
 //-----------------------------------------------------
 //
 //-----------------------------------------------------
@@ -0,0 +1,285 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "Exceptions.h"
+#include "PilatusLatencyCalibration.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+static const char CACHE_FILE_NAME[] = ".pilatus_latency";
+static const double RESOLUTION = 1e-6;		// camserver period resolution
+static const double FIRST_LATENCY = 1e-3;
+static const double MAX_LATENCY = 1.;
+static const int MAX_VERIFY_RETRY = 10;
+
+LatencyCalibration::LatencyCalibration(Camera& cam,
+				       const std::string& verify_path,
+				       const std::string& verify_pattern) :
+  m_cam(cam),
+  m_verify_path(verify_path),
+  m_verify_pattern(verify_pattern)
+{
+  DEB_CONSTRUCTOR();
+  const char* home = getenv("HOME");
+  m_cache_file = std::string(home ? home : "/tmp") + "/" + CACHE_FILE_NAME;
+}
+
+LatencyCalibration::~LatencyCalibration()
+{
+  DEB_DESTRUCTOR();
+}
+
+void LatencyCalibration::setCacheFile(const std::string& path)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(path);
+  m_cache_file = path;
+}
+//-----------------------------------------------------
+// camera must be idle, its exposure and period are restored
+//-----------------------------------------------------
+double LatencyCalibration::calibrate(const std::string& model,double exposure,
+				     bool verify,int nb_verify_frames)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR3(exposure,verify,nb_verify_frames);
+
+  if(m_cam.status() != Camera::STANDBY)
+    THROW_HW_ERROR(Error) << "Camera is not idle";
+  if(exposure <= 0.)
+    THROW_HW_ERROR(InvalidValue) << "Invalid exposure: " << DEB_VAR1(exposure);
+
+  double saved_exposure = m_cam.exposure();
+  double saved_exposure_period = m_cam.exposurePeriod();
+  double latency;
+  try
+    {
+      m_cam.setExposure(exposure);
+
+      double low = 0.,high = FIRST_LATENCY;
+      while(!_isAccepted(exposure + high))
+	{
+	  low = high;
+	  high *= 2.;
+	  if(high > MAX_LATENCY)
+	    THROW_HW_ERROR(Error) << "No exposure period accepted";
+	}
+      while(high - low > RESOLUTION)
+	{
+	  double middle = (low + high) / 2.;
+	  if(_isAccepted(exposure + middle))
+	    high = middle;
+	  else
+	    low = middle;
+	}
+      latency = ceil(high / RESOLUTION) * RESOLUTION;
+
+      if(verify)
+	{
+	  int retry = 0;
+	  for(;retry < MAX_VERIFY_RETRY &&
+		!_verify(exposure,latency,nb_verify_frames);++retry)
+	    latency *= 1.1;
+	  if(retry == MAX_VERIFY_RETRY)
+	    THROW_HW_ERROR(Error) << "Acquisition failed up to latency: "
+				  << DEB_VAR1(latency);
+	}
+    }
+  catch(...)
+    {
+      m_cam.setExposure(saved_exposure);
+      _isAccepted(saved_exposure_period);
+      throw;
+    }
+  m_cam.setExposure(saved_exposure);
+  _isAccepted(saved_exposure_period);
+
+  _save(model,exposure,latency);
+
+  DEB_RETURN() << DEB_VAR1(latency);
+  return latency;
+}
+//-----------------------------------------------------
+// cached latency for the nearest exposure
+//-----------------------------------------------------
+bool LatencyCalibration::lookup(const std::string& model,double exposure,
+				double& latency) const
+{
+  DEB_MEMBER_FUNCT();
+
+  std::ifstream cache(m_cache_file.c_str());
+  std::string key = _key(model);
+  std::string line;
+  bool found = false;
+  double best_distance = 0.;
+  while(std::getline(cache,line))
+    {
+      std::string::size_type values_pos = line.rfind('\t');
+      if(values_pos == std::string::npos)
+	continue;
+      values_pos = line.rfind('\t',values_pos - 1);
+      if(values_pos == std::string::npos ||
+	 line.compare(0,values_pos,key))
+	continue;
+
+      double line_exposure,line_latency;
+      std::istringstream values(line.substr(values_pos + 1));
+      if(!(values >> line_exposure >> line_latency))
+	continue;
+      double distance = fabs(line_exposure - exposure);
+      if(!found || distance < best_distance)
+	{
+	  found = true;
+	  best_distance = distance;
+	  latency = line_latency;
+	}
+    }
+  DEB_RETURN() << DEB_VAR2(found,latency);
+  return found;
+}
+
+bool LatencyCalibration::_isAccepted(double exposure_period)
+{
+  try
+    {
+      m_cam.setExposurePeriod(exposure_period);
+      return true;
+    }
+  catch(Exception&)
+    {
+      return false;
+    }
+}
+//-----------------------------------------------------
+// internal trigger acquisition, files are removed
+//-----------------------------------------------------
+bool LatencyCalibration::_verify(double exposure,double latency,int nb_frames)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(latency,nb_frames);
+
+  _Setup saved;
+  saved.trigger_mode = m_cam.triggerMode();
+  saved.nb_images = m_cam.nbImagesInSequence();
+  saved.imgpath = m_cam.imgpath();
+  saved.file_name = m_cam.fileName();
+
+  bool ok;
+  try
+    {
+      // never in the saving directory of the user
+      m_cam.setImgpath(m_verify_path);
+      m_cam.setFileName(m_verify_pattern);
+
+      double exposure_period = exposure + latency;
+      m_cam.setTriggerMode(Camera::INTERNAL_SINGLE);
+      m_cam.setNbImagesInSequence(nb_frames);
+      m_cam.setExposurePeriod(exposure_period);
+      m_cam.startAcquisition();
+
+      double timeout = nb_frames * exposure_period + 10.;
+      for(double waited = 0.;
+	  m_cam.status() == Camera::RUNNING && waited < timeout;
+	  waited += 10e-3)
+	usleep(10000);
+      if(m_cam.status() == Camera::RUNNING)
+	m_cam.stopAcquisition();
+      ok = m_cam.status() == Camera::STANDBY &&
+	m_cam.nbAcquiredImages() == nb_frames;
+    }
+  catch(...)
+    {
+      _restore(saved,nb_frames);
+      throw;
+    }
+  _restore(saved,nb_frames);
+
+  DEB_RETURN() << DEB_VAR1(ok);
+  return ok;
+}
+//-----------------------------------------------------
+// remove the verify files, camera setup is set back
+//-----------------------------------------------------
+void LatencyCalibration::_restore(const _Setup& saved,int nb_frames)
+{
+  for(int i = 0;i < nb_frames;++i)
+    {
+      char file_name[256];
+      snprintf(file_name,sizeof(file_name),m_verify_pattern.c_str(),i);
+      unlink((m_verify_path + "/" + file_name).c_str());
+    }
+
+  m_cam.setTriggerMode(saved.trigger_mode);
+  m_cam.setNbImagesInSequence(saved.nb_images);
+  m_cam.setFileName(saved.file_name);
+  if(!saved.imgpath.empty())
+    m_cam.setImgpath(saved.imgpath);
+}
+//-----------------------------------------------------
+// model, camserver version and trigger mode
+//-----------------------------------------------------
+std::string LatencyCalibration::_key(const std::string& model) const
+{
+  int major,minor,patch;
+  m_cam.version(major,minor,patch);
+  std::ostringstream key;
+  key << model << '\t' << major << '.' << minor << '.' << patch
+      << '\t' << int(m_cam.triggerMode());
+  return key.str();
+}
+
+void LatencyCalibration::_save(const std::string& model,double exposure,
+			       double latency)
+{
+  DEB_MEMBER_FUNCT();
+
+  std::ostringstream entry;
+  entry << _key(model) << '\t';
+  entry.precision(9);
+  entry << exposure;
+  std::string entry_prefix = entry.str() + '\t';
+  entry << '\t' << latency;
+
+  std::vector<std::string> lines;
+  std::ifstream cache(m_cache_file.c_str());
+  std::string line;
+  while(std::getline(cache,line))
+    if(line.compare(0,entry_prefix.size(),entry_prefix))
+      lines.push_back(line);
+  cache.close();
+  lines.push_back(entry.str());
+
+  std::string tmp_file = m_cache_file + ".tmp";
+  std::ofstream new_cache(tmp_file.c_str());
+  for(std::vector<std::string>::iterator i = lines.begin();i != lines.end();++i)
+    new_cache << *i << std::endl;
+  new_cache.close();
+  if(!new_cache || rename(tmp_file.c_str(),m_cache_file.c_str()))
+    DEB_ERROR() << "Can't write latency cache: " << m_cache_file;
+}
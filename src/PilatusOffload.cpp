@@ -0,0 +1,559 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include "Exceptions.h"
+#include "PilatusOffload.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+static const long COPY_CHUNK = 8 * 1024 * 1024;
+static const double RESCAN_DELAY = 1.;	// s
+
+static inline std::string _basename(const std::string& full_path)
+{
+  size_t pos = full_path.rfind('/');
+  return pos == std::string::npos ? full_path : full_path.substr(pos + 1);
+}
+
+static inline bool _endsWith(const std::string& name,const std::string& suffix)
+{
+  return name.size() >= suffix.size() &&
+    !name.compare(name.size() - suffix.size(),suffix.size(),suffix);
+}
+//-----------------------------------------------------
+// kernel copy, read/write when not possible (old kernel, other fs)
+//-----------------------------------------------------
+static bool _copyData(int fd_in,int fd_out,long long size)
+{
+  long long remaining = size;
+#ifdef __NR_copy_file_range
+  while(remaining > 0)
+    {
+      long chunk = remaining < COPY_CHUNK ? long(remaining) : COPY_CHUNK;
+      long nb_copied = syscall(__NR_copy_file_range,fd_in,NULL,fd_out,NULL,
+			       chunk,0);
+      if(nb_copied > 0)
+	remaining -= nb_copied;
+      else if(nb_copied < 0 && errno == EINTR)
+	continue;
+      else if(nb_copied < 0 && remaining == size &&
+	      (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+	       errno == EOPNOTSUPP))
+	break;
+      else
+	return false;
+    }
+  if(!remaining)
+    return true;
+#endif
+  char* buffer = (char*)malloc(COPY_CHUNK);
+  if(!buffer)
+    return false;
+  while(remaining > 0)
+    {
+      ssize_t nb_read = read(fd_in,buffer,COPY_CHUNK);
+      if(nb_read < 0 && errno == EINTR)
+	continue;
+      if(nb_read <= 0)
+	break;
+      for(ssize_t offset = 0;offset < nb_read;)
+	{
+	  ssize_t nb_written = write(fd_out,buffer + offset,nb_read - offset);
+	  if(nb_written < 0 && errno == EINTR)
+	    continue;
+	  if(nb_written <= 0)
+	    {
+	      free(buffer);
+	      return false;
+	    }
+	  offset += nb_written;
+	}
+      remaining -= nb_read;
+    }
+  free(buffer);
+  return !remaining;
+}
+
+Offload::Offload() :
+  m_nb_copies(DEFAULT_NB_COPIES),
+  m_frame_index(NULL),
+  m_quit(false),
+  m_inotify_fd(-1),
+  m_watch_descriptor(-1),
+  m_nb_running(0),
+  m_busy_start(0.)
+{
+  DEB_CONSTRUCTOR();
+  m_wake_pipe[0] = m_wake_pipe[1] = -1;
+  resetStats();
+}
+
+Offload::~Offload()
+{
+  DEB_DESTRUCTOR();
+  _stop();
+}
+//-----------------------------------------------------
+// empty path disables the offload, files queued are still copied
+//-----------------------------------------------------
+void Offload::setDestination(const std::string& path)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(path);
+
+  if(!path.empty())
+    {
+      struct stat dir_stat;
+      if(stat(path.c_str(),&dir_stat) || !S_ISDIR(dir_stat.st_mode))
+	THROW_HW_ERROR(InvalidValue) << "Not a directory: " << DEB_VAR1(path);
+    }
+  _stop();
+  AutoMutex aLock(m_cond.mutex());
+  m_destination = path;
+  aLock.unlock();
+  _restart();
+}
+//-----------------------------------------------------
+// index filled when files are closed, NULL for none
+//-----------------------------------------------------
+void Offload::setFrameIndex(FrameIndex* frame_index)
+{
+  DEB_MEMBER_FUNCT();
+
+  _stop();
+  AutoMutex aLock(m_cond.mutex());
+  m_frame_index = frame_index;
+  aLock.unlock();
+  _restart();
+}
+//-----------------------------------------------------
+// number of files copied in parallel
+//-----------------------------------------------------
+void Offload::setNbCopies(int nb_copies)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(nb_copies);
+  if(nb_copies < 1)
+    THROW_HW_ERROR(InvalidValue) << "Invalid number of copies: "
+				 << DEB_VAR1(nb_copies);
+  if(nb_copies == m_nb_copies)
+    return;
+
+  _stop();
+  m_nb_copies = nb_copies;
+  _restart();
+}
+//-----------------------------------------------------
+// called when saving is prepared, only the files of the
+// current series are offloaded
+//-----------------------------------------------------
+void Offload::watch(const std::string& directory,
+		    const std::string& prefix,const std::string& suffix)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR3(directory,prefix,suffix);
+
+  AutoMutex aLock(m_cond.mutex());
+  m_directory = directory;
+  m_prefix = prefix;
+  m_suffix = suffix;
+  if(m_inotify_fd < 0)
+    return;
+
+  if(m_watch_descriptor >= 0)
+    inotify_rm_watch(m_inotify_fd,m_watch_descriptor);
+  m_watch_descriptor = inotify_add_watch(m_inotify_fd,directory.c_str(),
+					 IN_CLOSE_WRITE | IN_MOVED_TO);
+  if(m_watch_descriptor < 0)
+    THROW_HW_ERROR(Error) << "Can't watch directory: " << DEB_VAR1(directory);
+}
+//-----------------------------------------------------
+// wait until all the files queued are offloaded,
+// false on timeout
+//-----------------------------------------------------
+bool Offload::wait(double timeout)
+{
+  double end = _now() + timeout;
+  AutoMutex aLock(m_cond.mutex());
+  while(!m_queue.empty() || m_nb_running)
+    {
+      if(timeout < 0.)
+	m_cond.wait();
+      else
+	{
+	  double remaining = end - _now();
+	  if(remaining <= 0.)
+	    return false;
+	  m_cond.wait(remaining);
+	}
+    }
+  return true;
+}
+
+void Offload::getStats(Stats& stats) const
+{
+  AutoMutex aLock(m_cond.mutex());
+  stats = m_stats;
+  stats.nb_pending = m_queue.size() + m_nb_running;
+  if(m_nb_running)
+    stats.busy_time += _now() - m_busy_start;
+  stats.throughput = stats.busy_time > 0. ?
+    stats.nb_bytes / stats.busy_time : 0.;
+}
+
+void Offload::resetStats()
+{
+  AutoMutex aLock(m_cond.mutex());
+  m_stats.nb_files = 0;
+  m_stats.nb_failed = 0;
+  m_stats.nb_pending = 0;
+  m_stats.nb_bytes = 0;
+  m_stats.busy_time = 0.;
+  m_stats.throughput = 0.;
+  if(m_nb_running)
+    m_busy_start = _now();
+}
+//-----------------------------------------------------
+// where a ramdisk file is once offloaded
+//-----------------------------------------------------
+std::string Offload::offloadedPath(const std::string& full_path) const
+{
+  AutoMutex aLock(m_cond.mutex());
+  if(m_destination.empty())
+    return full_path;
+  return m_destination + "/" + _basename(full_path);
+}
+
+//-----------------------------------------------------
+// threads run while there's something to do with the files
+//-----------------------------------------------------
+void Offload::_restart()
+{
+  AutoMutex aLock(m_cond.mutex());
+  bool needed = !m_destination.empty() || m_frame_index;
+  aLock.unlock();
+  if(needed)
+    _start();
+}
+
+void Offload::_start()
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex aLock(m_cond.mutex());
+  m_quit = false;
+  m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if(m_inotify_fd < 0)
+    THROW_HW_ERROR(Error) << "Can't initialize inotify";
+  if(pipe(m_wake_pipe))
+    {
+      close(m_inotify_fd);
+      m_inotify_fd = -1;
+      THROW_HW_ERROR(Error) << "Can't create pipe";
+    }
+  if(!m_directory.empty())
+    m_watch_descriptor = inotify_add_watch(m_inotify_fd,m_directory.c_str(),
+					   IN_CLOSE_WRITE | IN_MOVED_TO);
+
+  bool failed = pthread_create(&m_watch_thread,NULL,_watchFunc,this);
+  for(int i = 0;!failed && i < m_nb_copies;++i)
+    {
+      pthread_t thread_id;
+      failed = pthread_create(&thread_id,NULL,_copyFunc,this);
+      if(!failed)
+	m_copy_threads.push_back(thread_id);
+    }
+  if(failed)
+    {
+      aLock.unlock();
+      _stop();
+      THROW_HW_ERROR(Error) << "Can't start offload threads";
+    }
+}
+//-----------------------------------------------------
+// copy threads finish the queue before leaving
+//-----------------------------------------------------
+void Offload::_stop()
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex aLock(m_cond.mutex());
+  if(m_inotify_fd < 0)
+    return;
+  m_quit = true;
+  m_cond.broadcast();
+  if(write(m_wake_pipe[1],"q",1) != 1)
+    DEB_WARNING() << "Can't wake up offload watcher";
+  std::vector<pthread_t> threads;
+  threads.swap(m_copy_threads);
+  aLock.unlock();
+
+  pthread_join(m_watch_thread,NULL);
+  for(std::vector<pthread_t>::iterator i = threads.begin();i != threads.end();++i)
+    pthread_join(*i,NULL);
+
+  aLock.lock();
+  close(m_inotify_fd);
+  close(m_wake_pipe[0]);
+  close(m_wake_pipe[1]);
+  m_inotify_fd = -1;
+  m_watch_descriptor = -1;
+  m_wake_pipe[0] = m_wake_pipe[1] = -1;
+}
+
+void* Offload::_watchFunc(void* arg)
+{
+  ((Offload*)arg)->_watch();
+  return NULL;
+}
+
+void* Offload::_copyFunc(void* arg)
+{
+  ((Offload*)arg)->_copy();
+  return NULL;
+}
+
+void Offload::_watch()
+{
+  DEB_MEMBER_FUNCT();
+
+  char buffer[16 * 1024]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct pollfd fds[2];
+  fds[0].fd = m_inotify_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = m_wake_pipe[0];
+  fds[1].events = POLLIN;
+  double rescan_time = -1.;	// after an event overflow
+  while(true)
+    {
+      int timeout = -1;
+      if(rescan_time >= 0.)
+	{
+	  double remaining = rescan_time - _now();
+	  timeout = remaining > 0. ? int(remaining * 1e3) + 1 : 0;
+	}
+      int nb_ready = poll(fds,2,timeout);
+      if(nb_ready < 0 && errno != EINTR)
+	break;
+      if(nb_ready > 0 && fds[1].revents)
+	break;			// quit
+      ssize_t nb_read = 0;
+      if(nb_ready > 0 && fds[0].revents)
+	nb_read = read(m_inotify_fd,buffer,sizeof(buffer));
+
+      AutoMutex aLock(m_cond.mutex());
+      std::vector<std::string> full_paths;
+      for(char* p = buffer;p < buffer + nb_read;)
+	{
+	  const struct inotify_event* event = (const struct inotify_event*)p;
+	  p += sizeof(struct inotify_event) + event->len;
+	  if(event->mask & IN_Q_OVERFLOW)
+	    {
+	      DEB_WARNING() << "inotify queue overflow, events lost: "
+			    << m_directory << " will be rescanned";
+	      if(rescan_time < 0.)
+		rescan_time = _now() + RESCAN_DELAY;
+	      continue;
+	    }
+	  if(event->wd != m_watch_descriptor || !event->len)
+	    continue;
+	  std::string name = event->name;
+	  if(name.compare(0,m_prefix.size(),m_prefix) ||
+	     !_endsWith(name,m_suffix))
+	    continue;
+	  full_paths.push_back(m_directory + "/" + name);
+	}
+      if(rescan_time >= 0. && _now() >= rescan_time)
+	{
+	  bool recent = _rescan(full_paths);
+	  rescan_time = recent ? _now() + RESCAN_DELAY : -1.;
+	}
+      if(full_paths.empty())
+	continue;
+
+      // indexed while still on the ramdisk
+      if(m_frame_index)
+	{
+	  aLock.unlock();
+	  for(std::vector<std::string>::iterator i = full_paths.begin();
+	      i != full_paths.end();++i)
+	    m_frame_index->add(*i);
+	  aLock.lock();
+	}
+      if(!m_destination.empty())
+	{
+	  m_queue.insert(m_queue.end(),full_paths.begin(),full_paths.end());
+	  m_cond.broadcast();
+	}
+    }
+}
+//-----------------------------------------------------
+// files of the series not queued nor being copied, lock
+// must be held. A file modified less than RESCAN_DELAY ago
+// may still be written, it's left to its close event and
+// true is returned to rescan later.
+//-----------------------------------------------------
+bool Offload::_rescan(std::vector<std::string>& full_paths) const
+{
+  DEB_MEMBER_FUNCT();
+
+  DIR* dir = opendir(m_directory.c_str());
+  if(!dir)
+    {
+      DEB_ERROR() << "Can't rescan " << m_directory;
+      return false;
+    }
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME,&now);
+  bool recent = false;
+  int nb_found = 0;
+  while(struct dirent* entry = readdir(dir))
+    {
+      std::string name = entry->d_name;
+      if(name.compare(0,m_prefix.size(),m_prefix) ||
+	 !_endsWith(name,m_suffix))
+	continue;
+      std::string full_path = m_directory + "/" + name;
+      struct stat file_stat;
+      if(stat(full_path.c_str(),&file_stat) || !S_ISREG(file_stat.st_mode))
+	continue;
+      double age = (now.tv_sec - file_stat.st_mtim.tv_sec) +
+	(now.tv_nsec - file_stat.st_mtim.tv_nsec) * 1e-9;
+      if(age < RESCAN_DELAY)
+	{
+	  recent = true;
+	  continue;
+	}
+      if(m_copying.count(full_path) ||
+	 std::find(m_queue.begin(),m_queue.end(),full_path) != m_queue.end() ||
+	 std::find(full_paths.begin(),full_paths.end(),
+		   full_path) != full_paths.end())
+	continue;
+      full_paths.push_back(full_path);
+      ++nb_found;
+    }
+  closedir(dir);
+  DEB_TRACE() << DEB_VAR2(nb_found,recent);
+  return recent;
+}
+
+void Offload::_copy()
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex aLock(m_cond.mutex());
+  while(true)
+    {
+      if(m_queue.empty())
+	{
+	  if(m_quit)
+	    break;
+	  m_cond.wait();
+	  continue;
+	}
+      std::string full_path = m_queue.front();
+      m_queue.pop_front();
+      m_copying.insert(full_path);
+      std::string destination = m_destination;
+      if(!m_nb_running++)
+	m_busy_start = _now();
+      aLock.unlock();
+
+      long long nb_bytes = 0;
+      bool done = !destination.empty() &&
+	_copyFile(full_path,destination,nb_bytes);
+      if(!done)
+	DEB_ERROR() << "Can't offload " << DEB_VAR2(full_path,destination);
+
+      aLock.lock();
+      m_copying.erase(full_path);
+      if(done)
+	{
+	  ++m_stats.nb_files;
+	  m_stats.nb_bytes += nb_bytes;
+	}
+      else
+	++m_stats.nb_failed;
+      if(!--m_nb_running)
+	m_stats.busy_time += _now() - m_busy_start;
+      m_cond.broadcast();
+    }
+}
+//-----------------------------------------------------
+// the ramdisk file is removed once its copy is on disk
+//-----------------------------------------------------
+bool Offload::_copyFile(const std::string& full_path,
+			const std::string& destination,long long& nb_bytes)
+{
+  int fd_in = open(full_path.c_str(),O_RDONLY);
+  if(fd_in < 0)
+    return false;
+  struct stat file_stat;
+  if(fstat(fd_in,&file_stat))
+    {
+      close(fd_in);
+      return false;
+    }
+
+  std::string name = _basename(full_path);
+  std::string final_path = destination + "/" + name;
+  std::string tmp_path = destination + "/." + name + ".part";
+  int fd_out = open(tmp_path.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+  if(fd_out < 0)
+    {
+      close(fd_in);
+      return false;
+    }
+
+  bool done = _copyData(fd_in,fd_out,file_stat.st_size) && !fdatasync(fd_out);
+  close(fd_in);
+  done = !close(fd_out) && done;
+  if(done)
+    done = !rename(tmp_path.c_str(),final_path.c_str());
+  if(!done)
+    {
+      unlink(tmp_path.c_str());
+      return false;
+    }
+  unlink(full_path.c_str());
+  nb_bytes = file_stat.st_size;
+  return true;
+}
+
+double Offload::_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
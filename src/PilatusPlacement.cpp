@@ -0,0 +1,318 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sstream>
+#include "Exceptions.h"
+#include "PilatusPlacement.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+// from <numaif.h>, not to depend on libnuma
+static const int MPOL_BIND_MODE = 2;
+static const int MPOL_INTERLEAVE_MODE = 3;
+static const unsigned MPOL_MF_MOVE_FLAG = 1 << 1;
+
+static const char* ROLE_NAMES[] = {"camera thread","event thread",
+				   "worker threads"};
+
+/*******************************************************************
+ * \brief parse "0-3,8,10-11"
+ *******************************************************************/
+static bool _parse_list(const std::string& list,std::vector<int>& values)
+{
+  values.clear();
+  const char* p = list.c_str();
+  while(*p)
+    {
+      char* end;
+      long first = strtol(p,&end,10);
+      if(end == p || first < 0)
+	return false;
+      long last = first;
+      p = end;
+      if(*p == '-')
+	{
+	  ++p;
+	  last = strtol(p,&end,10);
+	  if(end == p || last < first)
+	    return false;
+	  p = end;
+	}
+      for(long value = first;value <= last;++value)
+	values.push_back(int(value));
+      if(*p == ',')
+	++p;
+      else if(*p)
+	return false;
+    }
+  return true;
+}
+
+static std::string _format_list(const std::vector<int>& values)
+{
+  std::ostringstream list;
+  for(size_t i = 0;i < values.size();)
+    {
+      size_t j = i;
+      while(j + 1 < values.size() && values[j + 1] == values[j] + 1)
+	++j;
+      if(i)
+	list << ',';
+      list << values[i];
+      if(j > i)
+	list << '-' << values[j];
+      i = j + 1;
+    }
+  return list.str();
+}
+
+/*******************************************************************
+ * \brief Placement
+ *******************************************************************/
+Placement::Placement() :
+  m_memory_policy(Default),
+  m_node_mask(0),
+  m_generation(0),
+  m_event_generation(-1),
+  m_event_thread_known(false),
+  m_raw_node(-1),
+  m_buffer_node(-1)
+{
+  DEB_CONSTRUCTOR();
+}
+
+Placement::~Placement()
+{
+  DEB_DESTRUCTOR();
+}
+//-----------------------------------------------------
+// cpus are applied by the caller, see applyCpus()
+//-----------------------------------------------------
+void Placement::setCpus(ThreadRole role,const std::string& cpus)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(role,cpus);
+
+  std::vector<int> values;
+  if(!_parse_list(cpus,values))
+    THROW_HW_ERROR(InvalidValue) << "Invalid cpu list: " << DEB_VAR1(cpus);
+  for(std::vector<int>::iterator i = values.begin();i != values.end();++i)
+    if(*i >= CPU_SETSIZE)
+      THROW_HW_ERROR(InvalidValue) << "Invalid cpu: " << DEB_VAR1(*i);
+
+  AutoMutex aLock(m_mutex);
+  m_cpus[role] = cpus;
+  if(role == EventThread)
+    ++m_generation;
+}
+
+const std::string& Placement::cpus(ThreadRole role) const
+{
+  return m_cpus[role];
+}
+
+void Placement::setMemoryPolicy(MemoryPolicy policy,const std::string& nodes)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(policy,nodes);
+
+  std::vector<int> values;
+  if(!_parse_list(nodes,values))
+    THROW_HW_ERROR(InvalidValue) << "Invalid node list: " << DEB_VAR1(nodes);
+  unsigned long node_mask = 0;
+  for(std::vector<int>::iterator i = values.begin();i != values.end();++i)
+    {
+      if(*i >= int(sizeof(node_mask) * 8))
+	THROW_HW_ERROR(InvalidValue) << "Invalid node: " << DEB_VAR1(*i);
+      node_mask |= 1UL << *i;
+    }
+  if(policy != Default && !node_mask)
+    THROW_HW_ERROR(InvalidValue) << "Node list is needed";
+
+  AutoMutex aLock(m_mutex);
+  m_memory_policy = policy;
+  m_memory_nodes = policy == Default ? "" : nodes;
+  m_node_mask = policy == Default ? 0 : node_mask;
+}
+
+void Placement::applyCpus(ThreadRole role,pthread_t thread) const
+{
+  DEB_MEMBER_FUNCT();
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  std::vector<int> values;
+  AutoMutex aLock(m_mutex);
+  _parse_list(m_cpus[role],values);
+  aLock.unlock();
+  if(values.empty())
+    for(int cpu = 0;cpu < CPU_SETSIZE;++cpu)
+      CPU_SET(cpu,&cpu_set);
+  else
+    for(std::vector<int>::iterator i = values.begin();i != values.end();++i)
+      CPU_SET(*i,&cpu_set);
+
+  int error = pthread_setaffinity_np(thread,sizeof(cpu_set),&cpu_set);
+  if(error)
+    THROW_HW_ERROR(Error) << "Can't set " << ROLE_NAMES[role] << " cpus: "
+			  << strerror(error);
+}
+//-----------------------------------------------------
+// event thread belongs to Lima, it's pinned from the frame
+// callback, i.e the first frame after a change
+//-----------------------------------------------------
+void Placement::applyToEventThread()
+{
+  DEB_MEMBER_FUNCT();
+
+  int generation = m_generation;
+  if(generation == m_event_generation)
+    return;
+
+  AutoMutex aLock(m_mutex);
+  m_event_generation = generation;
+  m_event_thread = pthread_self();
+  m_event_thread_known = true;
+  aLock.unlock();
+  try
+    {
+      applyCpus(EventThread,m_event_thread);
+    }
+  catch(Exception& e)
+    {
+      DEB_ERROR() << e.getErrMsg();
+    }
+}
+//-----------------------------------------------------
+// only pages not yet touched are placed, and only the whole
+// pages of the range: the others may hold other heap objects
+//-----------------------------------------------------
+void Placement::bindMemory(void* address,long length) const
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex aLock(m_mutex);
+  if(m_memory_policy == Default)
+    return;
+  int mode = m_memory_policy == Bind ? MPOL_BIND_MODE : MPOL_INTERLEAVE_MODE;
+  unsigned long node_mask = m_node_mask;
+  aLock.unlock();
+
+  unsigned long page_mask = sysconf(_SC_PAGESIZE) - 1;
+  unsigned long first_page = ((unsigned long)address + page_mask) & ~page_mask;
+  unsigned long end = ((unsigned long)address + length) & ~page_mask;
+  if(end <= first_page)
+    return;
+  if(syscall(SYS_mbind,first_page,end - first_page,mode,
+	     &node_mask,sizeof(node_mask) * 8,MPOL_MF_MOVE_FLAG))
+    DEB_ERROR() << "Can't bind frame buffer: " << strerror(errno);
+}
+//-----------------------------------------------------
+// frame buffer on whole pages, so it can be fully bound.
+// Same return as posix_memalign, released with free.
+//-----------------------------------------------------
+int Placement::allocateFrame(void** buffer,long length)
+{
+  long page_size = sysconf(_SC_PAGESIZE);
+  long size = (length + page_size - 1) / page_size * page_size;
+  return posix_memalign(buffer,page_size,size);
+}
+//-----------------------------------------------------
+// numa nodes of a delivered frame, raw file and/or buffer
+//-----------------------------------------------------
+void Placement::sampleFrame(const void* raw,const void* buffer)
+{
+  int raw_node = raw ? _node(raw) : -1;
+  int buffer_node = buffer ? _node(buffer) : -1;
+  AutoMutex aLock(m_mutex);
+  m_raw_node = raw_node;
+  m_buffer_node = buffer_node;
+}
+
+std::string Placement::report(pthread_t camera_thread,
+			      const std::vector<pthread_t>& worker_threads) const
+{
+  std::ostringstream report;
+  AutoMutex aLock(m_mutex);
+
+  report << ROLE_NAMES[CameraThread] << ": cpus "
+	 << _threadCpus(camera_thread) << std::endl;
+
+  report << ROLE_NAMES[EventThread] << ": ";
+  if(m_event_thread_known)
+    report << "cpus " << _threadCpus(m_event_thread) << std::endl;
+  else
+    report << "not yet known (no frame)" << std::endl;
+
+  for(size_t i = 0;i < worker_threads.size();++i)
+    report << "worker " << i << ": cpus "
+	   << _threadCpus(worker_threads[i]) << std::endl;
+
+  static const char* POLICY_NAMES[] = {"default","bind","interleave"};
+  report << "buffer memory: " << POLICY_NAMES[m_memory_policy];
+  if(m_memory_policy != Default)
+    report << " nodes " << m_memory_nodes;
+  report << std::endl;
+
+  report << "first frame of last acquisition: file node ";
+  if(m_raw_node >= 0)
+    report << m_raw_node;
+  else
+    report << "-";
+  report << ", buffer node ";
+  if(m_buffer_node >= 0)
+    report << m_buffer_node;
+  else
+    report << "-";
+  report << std::endl;
+  return report.str();
+}
+
+std::string Placement::_threadCpus(pthread_t thread)
+{
+  cpu_set_t cpu_set;
+  if(pthread_getaffinity_np(thread,sizeof(cpu_set),&cpu_set))
+    return "?";
+  std::vector<int> cpus;
+  for(int cpu = 0;cpu < CPU_SETSIZE;++cpu)
+    if(CPU_ISSET(cpu,&cpu_set))
+      cpus.push_back(cpu);
+  return _format_list(cpus);
+}
+//-----------------------------------------------------
+// node of the page, -1 if unknown (page not present)
+//-----------------------------------------------------
+int Placement::_node(const void* address)
+{
+  long page_size = sysconf(_SC_PAGESIZE);
+  void* page = (void*)((unsigned long)address & ~(page_size - 1));
+  int status = -1;
+  if(syscall(SYS_move_pages,0,1UL,&page,NULL,&status,0) || status < 0)
+    return -1;
+  return status;
+}
@@ -0,0 +1,197 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include "Exceptions.h"
+#include "PilatusProtocolLog.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+static const char LOG_MAGIC[8] = {'P','I','L','P','L','O','G','1'};
+static const int LOG_HEADER_SIZE = sizeof(LOG_MAGIC) + sizeof(long long);
+static const int RECORD_HEADER_SIZE = 1 + 1 + 4 + 8;
+
+ProtocolLog::ProtocolLog() :
+  m_file(NULL),
+  m_start(0),
+  m_nb_records(0)
+{
+  DEB_CONSTRUCTOR();
+}
+
+ProtocolLog::~ProtocolLog()
+{
+  DEB_DESTRUCTOR();
+  close();
+}
+//-----------------------------------------------------
+// start a new log, an existing file is overwritten
+//-----------------------------------------------------
+void ProtocolLog::open(const std::string& path)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(path);
+
+  close();
+
+  AutoMutex aLock(m_mutex);
+  FILE* file = fopen(path.c_str(),"w");
+  if(!file)
+    THROW_HW_ERROR(Error) << "Can't open protocol log " << path
+			  << ": " << strerror(errno);
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME,&now);
+  long long start_time = now.tv_sec * 1000000000LL + now.tv_nsec;
+  char header[LOG_HEADER_SIZE];
+  memcpy(header,LOG_MAGIC,sizeof(LOG_MAGIC));
+  memcpy(header + sizeof(LOG_MAGIC),&start_time,sizeof(start_time));
+  if(fwrite(header,sizeof(header),1,file) != 1 || fflush(file))
+    {
+      fclose(file);
+      THROW_HW_ERROR(Error) << "Can't write protocol log " << path;
+    }
+
+  m_file = file;
+  m_path = path;
+  m_start = _now();
+  m_nb_records = 0;
+}
+
+void ProtocolLog::close()
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex aLock(m_mutex);
+  if(!m_file)
+    return;
+  if(fclose(m_file))
+    DEB_ERROR() << "Error while closing protocol log " << m_path;
+  m_file = NULL;
+  DEB_TRACE() << DEB_VAR2(m_path,m_nb_records);
+}
+
+bool ProtocolLog::isOpen() const
+{
+  AutoMutex aLock(m_mutex);
+  return !!m_file;
+}
+//-----------------------------------------------------
+// append a record, flushed at once so a crash doesn't lose
+// the tail. A write error stops the log without disturbing
+// the camera
+//-----------------------------------------------------
+void ProtocolLog::record(Type type,int status,const char* data,int size)
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex aLock(m_mutex);
+  if(!m_file)
+    return;
+
+  long long timestamp = _now() - m_start;
+  unsigned int length = size;
+  char header[RECORD_HEADER_SIZE];
+  header[0] = char(type);
+  header[1] = char(status);
+  memcpy(header + 2,&length,sizeof(length));
+  memcpy(header + 6,&timestamp,sizeof(timestamp));
+  if(fwrite(header,sizeof(header),1,m_file) != 1 ||
+     (size && fwrite(data,size,1,m_file) != 1) ||
+     fflush(m_file))
+    {
+      DEB_ERROR() << "Can't write protocol log " << m_path
+		  << ", recording stopped";
+      fclose(m_file);
+      m_file = NULL;
+      return;
+    }
+  ++m_nb_records;
+}
+
+long long ProtocolLog::nbRecords() const
+{
+  AutoMutex aLock(m_mutex);
+  return m_nb_records;
+}
+
+long long ProtocolLog::_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+//-----------------------------------------------------
+// ProtocolLog::Reader
+//-----------------------------------------------------
+ProtocolLog::Reader::Reader(const std::string& path) :
+  m_start_time(0)
+{
+  DEB_CONSTRUCTOR();
+  DEB_PARAM() << DEB_VAR1(path);
+
+  m_file = fopen(path.c_str(),"r");
+  if(!m_file)
+    THROW_HW_ERROR(Error) << "Can't open protocol log " << path
+			  << ": " << strerror(errno);
+
+  char header[LOG_HEADER_SIZE];
+  if(fread(header,sizeof(header),1,m_file) != 1 ||
+     memcmp(header,LOG_MAGIC,sizeof(LOG_MAGIC)))
+    {
+      fclose(m_file);
+      THROW_HW_ERROR(Error) << path << " is not a protocol log";
+    }
+  memcpy(&m_start_time,header + sizeof(LOG_MAGIC),sizeof(m_start_time));
+}
+
+ProtocolLog::Reader::~Reader()
+{
+  DEB_DESTRUCTOR();
+  fclose(m_file);
+}
+//-----------------------------------------------------
+// false at the end of the log, a truncated last
+// record (log not closed) is ignored
+//-----------------------------------------------------
+bool ProtocolLog::Reader::next(Record& record)
+{
+  DEB_MEMBER_FUNCT();
+
+  char header[RECORD_HEADER_SIZE];
+  if(fread(header,sizeof(header),1,m_file) != 1)
+    return false;
+
+  unsigned int length;
+  record.type = Type(header[0]);
+  record.status = header[1];
+  memcpy(&length,header + 2,sizeof(length));
+  memcpy(&record.timestamp,header + 6,sizeof(record.timestamp));
+  record.data.resize(length);
+  if(length && fread(&record.data[0],length,1,m_file) != 1)
+    {
+      DEB_WARNING() << "Truncated protocol log record";
+      return false;
+    }
+  return true;
+}
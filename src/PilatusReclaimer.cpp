@@ -0,0 +1,239 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef WITH_IO_URING
+#include <fcntl.h>
+#include <liburing.h>
+#endif
+#include "Exceptions.h"
+#include "PilatusReclaimer.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+static const double BATCH_DELAY = 0.005; // second
+
+Reclaimer::Reclaimer() :
+  m_quit(false),
+  m_busy(false),
+  m_nb_reclaimed(0),
+  m_ring(NULL)
+{
+  DEB_CONSTRUCTOR();
+
+  m_items.reserve(BATCH_SIZE * 4);
+  m_paths.reserve(BATCH_SIZE * 4);
+#ifdef WITH_IO_URING
+  struct io_uring* ring = new struct io_uring;
+  if(io_uring_queue_init(BATCH_SIZE,ring,0))
+    {
+      DEB_WARNING() << "io_uring not available, unlink(2) will be used";
+      delete ring;
+    }
+  else
+    m_ring = ring;
+#endif
+  if(pthread_create(&m_thread_id,NULL,_runFunc,this))
+    THROW_HW_ERROR(Error) << "Can't start reclaimer thread";
+}
+
+Reclaimer::~Reclaimer()
+{
+  DEB_DESTRUCTOR();
+
+  AutoMutex aLock(m_cond.mutex());
+  m_quit = true;
+  m_cond.broadcast();
+  aLock.unlock();
+  pthread_join(m_thread_id,NULL);
+
+#ifdef WITH_IO_URING
+  if(m_ring)
+    {
+      io_uring_queue_exit((struct io_uring*)m_ring);
+      delete (struct io_uring*)m_ring;
+    }
+#endif
+}
+//-----------------------------------------------------
+// queue a file mapping
+//-----------------------------------------------------
+void Reclaimer::unmap(void* base,long length)
+{
+  Item item = {base,length};
+  AutoMutex aLock(m_cond.mutex());
+  m_items.push_back(item);
+  _push();
+}
+//-----------------------------------------------------
+// queue a buffer allocated with malloc or posix_memalign
+//-----------------------------------------------------
+void Reclaimer::free(void* buffer)
+{
+  if(!buffer)
+    return;
+  Item item = {buffer,0};
+  AutoMutex aLock(m_cond.mutex());
+  m_items.push_back(item);
+  _push();
+}
+//-----------------------------------------------------
+// queue a tmpfs file
+//-----------------------------------------------------
+void Reclaimer::unlink(const char* full_path)
+{
+  AutoMutex aLock(m_cond.mutex());
+  m_paths.push_back(full_path);
+  _push();
+}
+//-----------------------------------------------------
+// wait until everything queued is reclaimed
+//-----------------------------------------------------
+void Reclaimer::flush()
+{
+  AutoMutex aLock(m_cond.mutex());
+  m_cond.broadcast();
+  while(m_busy || !m_items.empty() || !m_paths.empty())
+    m_cond.wait();
+}
+
+long long Reclaimer::nbReclaimed() const
+{
+  AutoMutex aLock(m_cond.mutex());
+  return m_nb_reclaimed;
+}
+//-----------------------------------------------------
+// wake up the thread only to start or end a batch (lock held)
+//-----------------------------------------------------
+void Reclaimer::_push()
+{
+  size_t nb_queued = m_items.size() + m_paths.size();
+  if(nb_queued == 1 || nb_queued == BATCH_SIZE)
+    m_cond.broadcast();
+}
+
+void* Reclaimer::_runFunc(void* arg)
+{
+  ((Reclaimer*)arg)->_run();
+  return NULL;
+}
+
+void Reclaimer::_run()
+{
+  DEB_MEMBER_FUNCT();
+
+  std::vector<Item> items;
+  std::vector<std::string> paths;
+  items.reserve(BATCH_SIZE * 4);
+  paths.reserve(BATCH_SIZE * 4);
+
+  AutoMutex aLock(m_cond.mutex());
+  while(true)
+    {
+      if(m_items.empty() && m_paths.empty())
+	{
+	  m_busy = false;
+	  m_cond.broadcast();	// flush
+	  if(m_quit)
+	    break;
+	  m_cond.wait();
+	  continue;
+	}
+      // let a batch build up, unless asked to go now
+      if(!m_quit && m_items.size() + m_paths.size() < BATCH_SIZE)
+	m_cond.wait(BATCH_DELAY);
+
+      m_busy = true;
+      items.swap(m_items);
+      paths.swap(m_paths);
+      aLock.unlock();
+
+      _reclaim(items,paths);
+
+      aLock.lock();
+      m_nb_reclaimed += items.size() + paths.size();
+      items.clear();
+      paths.clear();
+    }
+}
+
+void Reclaimer::_reclaim(std::vector<Item>& items,
+			 std::vector<std::string>& paths)
+{
+  for(std::vector<Item>::iterator i = items.begin();i != items.end();++i)
+    {
+      if(i->length)
+	munmap(i->base,i->length);
+      else
+	::free(i->base);
+    }
+  if(!paths.empty())
+    _unlink(paths);
+}
+
+#ifdef WITH_IO_URING
+void Reclaimer::_unlink(std::vector<std::string>& paths)
+{
+  struct io_uring* ring = (struct io_uring*)m_ring;
+  std::vector<std::string>::iterator i = paths.begin();
+  while(ring && i != paths.end())
+    {
+      int nb_submitted = 0;
+      for(;i != paths.end();++i,++nb_submitted)
+	{
+	  struct io_uring_sqe* sqe = io_uring_get_sqe(ring);
+	  if(!sqe)
+	    break;
+	  io_uring_prep_unlinkat(sqe,AT_FDCWD,i->c_str(),0);
+	}
+      io_uring_submit(ring);
+      bool aNotSupported = false;
+      for(int n = 0;n < nb_submitted;++n)
+	{
+	  struct io_uring_cqe* cqe;
+	  if(io_uring_wait_cqe(ring,&cqe))
+	    break;
+	  aNotSupported |= cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP;
+	  io_uring_cqe_seen(ring,cqe);
+	}
+      if(aNotSupported)
+	{
+	  // unlinkat opcode not in this kernel, redo with unlink(2)
+	  i -= nb_submitted;
+	  io_uring_queue_exit(ring);
+	  delete ring;
+	  m_ring = ring = NULL;
+	}
+    }
+  for(;i != paths.end();++i)
+    ::unlink(i->c_str());
+}
+#else
+void Reclaimer::_unlink(std::vector<std::string>& paths)
+{
+  for(std::vector<std::string>::iterator i = paths.begin();i != paths.end();++i)
+    ::unlink(i->c_str());
+}
+#endif
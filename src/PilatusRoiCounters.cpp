@@ -0,0 +1,250 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "Exceptions.h"
+#include "PilatusRoiCounters.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+/*******************************************************************
+ * \brief roi line sum, negative pixels are ignored
+ *******************************************************************/
+static long long _sum_line_scalar(const int* src,int len)
+{
+  long long sum = 0;
+  for(int i = 0;i < len;++i)
+    if(src[i] > 0)
+      sum += src[i];
+  return sum;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static long long _sum_line_avx2(const int* src,int len)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i sum_low = zero,sum_high = zero;
+  int i = 0;
+  for(;i + 8 <= len;i += 8)
+    {
+      __m256i value = _mm256_max_epi32(_mm256_loadu_si256((const __m256i*)(src + i)),
+				       zero);
+      sum_low = _mm256_add_epi64(sum_low,
+				 _mm256_cvtepu32_epi64(_mm256_castsi256_si128(value)));
+      sum_high = _mm256_add_epi64(sum_high,
+				  _mm256_cvtepu32_epi64(_mm256_extracti128_si256(value,1)));
+    }
+  long long sums[4] __attribute__((aligned(32)));
+  _mm256_store_si256((__m256i*)sums,_mm256_add_epi64(sum_low,sum_high));
+  return sums[0] + sums[1] + sums[2] + sums[3] + _sum_line_scalar(src + i,len - i);
+}
+
+typedef long long (*_sum_line_func)(const int*,int);
+static _sum_line_func _get_sum_line()
+{
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return _sum_line_avx2;
+  return _sum_line_scalar;
+}
+static const _sum_line_func _sum_line = _get_sum_line();
+#else
+#define _sum_line _sum_line_scalar
+#endif
+
+/*******************************************************************
+ * \brief RoiCounters
+ *******************************************************************/
+RoiCounters::RoiCounters() :
+  m_active(false),
+  m_fifo_size(DEFAULT_FIFO_SIZE),
+  m_read_index(0),
+  m_nb_available(0),
+  m_nb_lost(0),
+  m_last_frame_nb(-1)
+{
+  DEB_CONSTRUCTOR();
+}
+
+RoiCounters::~RoiCounters()
+{
+  DEB_DESTRUCTOR();
+}
+
+void RoiCounters::setDetectorSize(const Size& det_size)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(det_size);
+  m_det_size = det_size;
+}
+
+void RoiCounters::setActive(bool flag)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(flag);
+  if(flag && m_rois.empty())
+    THROW_HW_ERROR(Error) << "No roi defined";
+  m_active = flag;
+}
+//-----------------------------------------------------
+// rois are in raw detector coordinates
+//-----------------------------------------------------
+void RoiCounters::setRois(const std::vector<Roi>& rois)
+{
+  DEB_MEMBER_FUNCT();
+
+  for(std::vector<Roi>::const_iterator i = rois.begin();i != rois.end();++i)
+    {
+      const Point& top_left = i->getTopLeft();
+      Point bottom_right = i->getBottomRight();
+      if(i->isEmpty() || top_left.x < 0 || top_left.y < 0 ||
+	 bottom_right.x >= m_det_size.getWidth() ||
+	 bottom_right.y >= m_det_size.getHeight())
+	THROW_HW_ERROR(InvalidValue) << "Roi out of the detector: "
+				     << DEB_VAR2(*i,m_det_size);
+    }
+
+  AutoMutex aLock(m_cond.mutex());
+  m_rois = rois;
+  if(m_rois.empty())
+    m_active = false;
+  m_frame_sums.resize(m_rois.size());
+  m_sums.clear();
+  m_nb_available = 0;
+}
+
+void RoiCounters::setFifoSize(int nb_frames)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(nb_frames);
+  if(nb_frames <= 0)
+    THROW_HW_ERROR(InvalidValue) << "Invalid fifo size: " << DEB_VAR1(nb_frames);
+
+  AutoMutex aLock(m_cond.mutex());
+  m_fifo_size = nb_frames;
+  m_sums.clear();
+  m_nb_available = 0;
+}
+//-----------------------------------------------------
+// empty the fifo, counters of previous acquisition are lost
+//-----------------------------------------------------
+void RoiCounters::prepare()
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex aLock(m_cond.mutex());
+  m_frame_nbs.resize(m_fifo_size);
+  m_sums.resize(size_t(m_fifo_size) * m_rois.size());
+  m_read_index = 0;
+  m_nb_available = 0;
+  m_nb_lost = 0;
+  m_last_frame_nb = -1;
+}
+//-----------------------------------------------------
+// only called by the ingest, the fifo is never blocking
+//-----------------------------------------------------
+void RoiCounters::compute(int frame_nb,const int* raw)
+{
+  AutoMutex aLock(m_cond.mutex());
+  int nb_rois = m_rois.size();
+  if(!nb_rois || m_sums.size() != size_t(m_fifo_size) * nb_rois)
+    return;			// rois changed since prepare
+
+  int width = m_det_size.getWidth();
+  for(int roi_id = 0;roi_id < nb_rois;++roi_id)
+    {
+      const Roi& roi = m_rois[roi_id];
+      const Point& top_left = roi.getTopLeft();
+      const Size& size = roi.getSize();
+      const int* line = raw + long(top_left.y) * width + top_left.x;
+      long long sum = 0;
+      for(int y = 0;y < size.getHeight();++y,line += width)
+	sum += _sum_line(line,size.getWidth());
+      m_frame_sums[roi_id] = sum;
+    }
+
+  if(m_nb_available == m_fifo_size)
+    {
+      m_read_index = (m_read_index + 1) % m_fifo_size;
+      --m_nb_available;
+      ++m_nb_lost;
+    }
+  int write_index = (m_read_index + m_nb_available) % m_fifo_size;
+  m_frame_nbs[write_index] = frame_nb;
+  std::copy(m_frame_sums.begin(),m_frame_sums.end(),
+	    m_sums.begin() + size_t(write_index) * nb_rois);
+  ++m_nb_available;
+  m_last_frame_nb = frame_nb;
+  m_cond.broadcast();
+}
+//-----------------------------------------------------
+// pop available counters, sums has nb rois values per frame.
+// wait up to timeout for the first one (< 0 is forever)
+//-----------------------------------------------------
+int RoiCounters::readCounters(std::vector<int>& frame_nbs,
+			      std::vector<long long>& sums,
+			      int max_nb_frames,double timeout)
+{
+  DEB_MEMBER_FUNCT();
+
+  frame_nbs.clear();
+  sums.clear();
+
+  AutoMutex aLock(m_cond.mutex());
+  if(!m_nb_available && timeout != 0.)
+    m_cond.wait(timeout);
+
+  int nb_rois = m_rois.size();
+  int nb_frames = m_nb_available;
+  if(max_nb_frames >= 0 && nb_frames > max_nb_frames)
+    nb_frames = max_nb_frames;
+
+  frame_nbs.reserve(nb_frames);
+  sums.reserve(size_t(nb_frames) * nb_rois);
+  for(int i = 0;i < nb_frames;++i)
+    {
+      frame_nbs.push_back(m_frame_nbs[m_read_index]);
+      std::vector<long long>::const_iterator first =
+	m_sums.begin() + size_t(m_read_index) * nb_rois;
+      sums.insert(sums.end(),first,first + nb_rois);
+      m_read_index = (m_read_index + 1) % m_fifo_size;
+    }
+  m_nb_available -= nb_frames;
+
+  DEB_RETURN() << DEB_VAR1(nb_frames);
+  return nb_frames;
+}
+
+int RoiCounters::nbLostFrames() const
+{
+  AutoMutex aLock(m_cond.mutex());
+  return m_nb_lost;
+}
+
+int RoiCounters::lastFrameNb() const
+{
+  AutoMutex aLock(m_cond.mutex());
+  return m_last_frame_nb;
+}
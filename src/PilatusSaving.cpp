@@ -23,6 +23,12 @@
     #include <cbf.h>
     #include <cbf_simple.h>
 #endif
+#include <algorithm>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "PilatusSaving.h"
 #include "PilatusCamera.h"
 
@@ -32,7 +38,9 @@ using namespace lima::Pilatus;
 SavingCtrlObj::SavingCtrlObj(Camera& camera) : 
   HwSavingCtrlObj(HwSavingCtrlObj::COMMON_HEADER|
 		  HwSavingCtrlObj::MANUAL_READ),
-  m_cam(camera)
+  m_cam(camera),
+  m_frame_index_active(false),
+  m_header_queued(false)
 {
 }
 
@@ -47,17 +55,207 @@ void SavingCtrlObj::getPossibleSaveFormat(std::list<std::string> &format_list) c
 #endif    
 }
 
+/** with the frame cache, Lima gets a copy of the cached frame
+    as it frees the buffer it's given.
+*/
 void SavingCtrlObj::readFrame(HwFrameInfoType &frame_info,int frame_nr)
 {
   DEB_MEMBER_FUNCT();
 #ifdef WITH_CBF_SAVING  
-  FrameDim anImageDim;
-  std::string errmsg;
+  if(!m_frame_cache.isActive())
+    {
+      _readFrame(frame_info,frame_nr);
+      return;
+    }
+
+  FrameCache::Ref frame;
+  getFrame(frame,frame_nr);
+  long mem_size = frame->mem_size;
+  void *aDataBuffer;
+  if(posix_memalign(&aDataBuffer,16,mem_size))
+    THROW_HW_ERROR(Error) << "Can't allocate memory";
+  memcpy(aDataBuffer,frame->data,mem_size);
+  FrameDim anImageDim(frame->width,frame->height,Bpp32S);
+  frame_info = HwFrameInfoType(frame_nr,aDataBuffer,&anImageDim,
+			       Timestamp(),0,
+			       HwFrameInfoType::Shared);
+#endif
+}
+/** decoded frame shared with the cache (no copy),
+    it's decoded and kept if it's not in the cache.
+*/
+void SavingCtrlObj::getFrame(FrameCache::Ref& frame,int frame_nr)
+{
+  DEB_MEMBER_FUNCT();
+#ifdef WITH_CBF_SAVING
+  std::string fullPath = _getFullPath(frame_nr);
+  struct stat file_stat;
+  if(stat(fullPath.c_str(),&file_stat) && m_offload.isActive())
+    {
+      fullPath = m_offload.offloadedPath(fullPath);
+      if(stat(fullPath.c_str(),&file_stat))
+	THROW_HW_ERROR(Error) << "File : " << fullPath << " doesn't exist";
+    }
+  long long mtime = file_stat.st_mtim.tv_sec * 1000000000LL +
+    file_stat.st_mtim.tv_nsec;
+  if(m_frame_cache.get(fullPath,mtime,frame))
+    return;
+
+  HwFrameInfoType frame_info;
+  _readFrame(frame_info,frame_nr);
+  const Size& aSize = frame_info.frame_dim.getSize();
+  frame = m_frame_cache.insert(fullPath,mtime,aSize.getWidth(),
+			       aSize.getHeight(),frame_info.frame_ptr);
+#else
+  THROW_HW_ERROR(NotSupported) << "Lima is not compiled with the cbf "
+                                  "saving option";
+#endif
+}
+
+#ifdef WITH_CBF_SAVING
+void SavingCtrlObj::_readFrame(HwFrameInfoType &frame_info,int frame_nr)
+{
+  DEB_MEMBER_FUNCT();
   std::string fullPath = _getFullPath(frame_nr);
+  if(m_frame_index_active && _readIndexed(fullPath,frame_nr,frame_info))
+    return;
+
   FILE* fd = fopen(fullPath.c_str(),"r");
+  if(!fd && m_offload.isActive())
+    {
+      // may already be moved from the ramdisk
+      fullPath = m_offload.offloadedPath(fullPath);
+      fd = fopen(fullPath.c_str(),"r");
+    }
   if(!fd)
     THROW_HW_ERROR(Error) << "File : " << fullPath << " doesn't exist";
 
+  _decode(fd,fullPath,frame_nr,frame_info);
+}
+#endif
+/** read nb_frames files from first_frame_nr by batches of
+    BatchReader::QUEUE_DEPTH, frames are decoded from memory.
+*/
+void SavingCtrlObj::readFrames(std::vector<HwFrameInfoType>& frames,
+			       int first_frame_nr,int nb_frames)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR2(first_frame_nr,nb_frames);
+#ifdef WITH_CBF_SAVING
+  AutoMutex aLock(m_batch_mutex);
+  frames.clear();
+  frames.reserve(nb_frames);
+  try
+    {
+      std::vector<BatchReader::File> files;
+      for(int first = 0;first < nb_frames;first += BatchReader::QUEUE_DEPTH)
+	{
+	  int nb_files = std::min(nb_frames - first,
+				  int(BatchReader::QUEUE_DEPTH));
+	  files.resize(nb_files);
+	  for(int i = 0;i < nb_files;++i)
+	    {
+	      std::string fullPath = _getFullPath(first_frame_nr + first + i);
+	      if(m_offload.isActive() && access(fullPath.c_str(),F_OK))
+		fullPath = m_offload.offloadedPath(fullPath);
+	      files[i].path = fullPath;
+	    }
+	  m_batch_reader.read(files);
+
+	  for(int i = 0;i < nb_files;++i)
+	    {
+	      const BatchReader::File& file = files[i];
+	      if(!file.data)
+		THROW_HW_ERROR(Error) << "File : " << file.path
+				      << " doesn't exist";
+	      FILE* fd = fmemopen((void*)file.data,file.size,"r");
+	      if(!fd)
+		THROW_HW_ERROR(Error) << "Can't open in memory : " << file.path;
+	      HwFrameInfoType frame_info;
+	      _decode(fd,file.path,first_frame_nr + first + i,frame_info);
+	      frames.push_back(frame_info);
+	    }
+	}
+    }
+  catch(...)
+    {
+      for(std::vector<HwFrameInfoType>::iterator i = frames.begin();
+	  i != frames.end();++i)
+	free(i->frame_ptr);
+      frames.clear();
+      throw;
+    }
+#endif
+}
+
+/** index of the next series, written when camserver closes the files.
+    readFrame uses it to read the binary section directly.
+*/
+void SavingCtrlObj::setFrameIndexActive(bool flag)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(flag);
+
+  m_frame_index_active = flag;
+  m_offload.setFrameIndex(flag ? &m_frame_index : NULL);
+  if(!flag)
+    m_frame_index.close();
+}
+
+#ifdef WITH_CBF_SAVING
+/** byte offset frames found in the index are decoded without CBFLib,
+    false to fall back on the full parsing
+*/
+bool SavingCtrlObj::_readIndexed(const std::string& fullPath,
+				 int frame_nr,HwFrameInfoType& frame_info)
+{
+  DEB_MEMBER_FUNCT();
+
+  size_t pos = fullPath.rfind('/');
+  int file_number = m_frame_index.fileNumber(fullPath.substr(pos + 1));
+  FrameIndex::Record record;
+  if(file_number < 0 || !m_frame_index.lookup(file_number,record) ||
+     record.compression != FrameIndex::ByteOffset ||
+     record.element_size != sizeof(int) || !record.is_signed)
+    return false;
+
+  int fd = open(fullPath.c_str(),O_RDONLY);
+  if(fd < 0 && m_offload.isActive())
+    fd = open(m_offload.offloadedPath(fullPath).c_str(),O_RDONLY);
+  if(fd < 0)
+    return false;
+  std::vector<char> binary(record.binary_size);
+  bool ok = pread(fd,&binary[0],binary.size(),record.binary_offset) ==
+    ssize_t(binary.size());
+  close(fd);
+  if(!ok)
+    return false;
+
+  long nb_pixels = long(record.width) * record.height;
+  void *aDataBuffer;
+  if(posix_memalign(&aDataBuffer,16,nb_pixels * sizeof(int)))
+    THROW_HW_ERROR(Error) << "Can't allocate memory";
+  if(!FrameIndex::decodeByteOffset(&binary[0],binary.size(),
+				   (int*)aDataBuffer,nb_pixels))
+    {
+      free(aDataBuffer);
+      return false;
+    }
+
+  FrameDim anImageDim(record.width,record.height,Bpp32S);
+  frame_info = HwFrameInfoType(frame_nr,aDataBuffer,&anImageDim,
+			       Timestamp(),0,
+			       HwFrameInfoType::Shared);
+  return true;
+}
+
+void SavingCtrlObj::_decode(FILE* fd,const std::string& fullPath,
+			    int frame_nr,HwFrameInfoType& frame_info)
+{
+  DEB_MEMBER_FUNCT();
+  FrameDim anImageDim;
+  std::string errmsg;
+
   cbf_handle handle;
   if(cbf_make_handle(&handle))
     {
@@ -105,25 +303,78 @@ void SavingCtrlObj::readFrame(HwFrameInfoType &frame_info,int frame_nr)
   fclose(fd);
   if(!errmsg.empty())
     THROW_HW_ERROR(Error) << errmsg;
-#endif
 }
+#endif
 
+/** only the keys changed since the last call are sent.
+    In queued mode they are merged and sent once, in a single
+    mxsettings, when the saving is prepared.
+*/
 void SavingCtrlObj::setCommonHeader(const HeaderMap &header)
 {
   DEB_MEMBER_FUNCT();
 
-  std::string cmd = "mxsettings ";
+  HeaderMap changed;
   for(HeaderMap::const_iterator i = header.begin();
       i != header.end();++i)
     {
+      HeaderMap::const_iterator pending = m_pending_header.find(i->first);
+      const HeaderMap& current = pending != m_pending_header.end() ?
+	m_pending_header : m_applied_header;
+      HeaderMap::const_iterator value = current.find(i->first);
+      if(value == current.end() || value->second != i->second)
+	changed[i->first] = i->second;
+    }
+  if(changed.empty())
+    return;
+
+  if(m_header_queued)
+    {
+      for(HeaderMap::const_iterator i = changed.begin();
+	  i != changed.end();++i)
+	m_pending_header[i->first] = i->second;
+      return;
+    }
 
+  std::string errorMessage =
+    m_cam.sendAnyCommandAndGetErrorMsg(_headerCommand(changed));
+  if(!errorMessage.empty())
+    {
+      // don't know what camserver has taken
+      m_applied_header.clear();
+      THROW_HW_ERROR(lima::Error) << errorMessage;
+    }
+  for(HeaderMap::const_iterator i = changed.begin();
+      i != changed.end();++i)
+    m_applied_header[i->first] = i->second;
+}
+
+void SavingCtrlObj::setHeaderQueued(bool flag)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(flag);
+  m_header_queued = flag;
+}
+/** forget what was sent, i.e after a camserver restart
+ */
+void SavingCtrlObj::resetHeaderCache()
+{
+  DEB_MEMBER_FUNCT();
+  m_applied_header.clear();
+}
+
+std::string SavingCtrlObj::_headerCommand(const HeaderMap &header)
+{
+  std::string cmd = "mxsettings";
+  for(HeaderMap::const_iterator i = header.begin();
+      i != header.end();++i)
+    {
+      cmd += ' ';
       cmd += i->first;
       cmd += ' ';
       cmd += i->second;
     }
-  std::string errorMessage = m_cam.sendAnyCommandAndGetErrorMsg(cmd);
-  if(!errorMessage.empty())
-    THROW_HW_ERROR(lima::Error) << errorMessage;
+  return cmd;
 }
 
 void SavingCtrlObj::_prepare()
@@ -133,7 +384,23 @@ void SavingCtrlObj::_prepare()
   if(m_suffix != ".cbf")
     THROW_HW_ERROR(lima::Error) << "Suffix must be .cbf";
 
-  m_cam.setImgpath(m_directory);
+  // queued header changes, all in one command
+  if(!m_pending_header.empty())
+    {
+      std::string errorMessage =
+	m_cam.sendAnyCommandAndGetErrorMsg(_headerCommand(m_pending_header));
+      if(!errorMessage.empty())
+	{
+	  // don't know what camserver has taken
+	  m_applied_header.clear();
+	  m_pending_header.clear();
+	  THROW_HW_ERROR(lima::Error) << errorMessage;
+	}
+      for(HeaderMap::const_iterator i = m_pending_header.begin();
+	  i != m_pending_header.end();++i)
+	m_applied_header[i->first] = i->second;
+      m_pending_header.clear();
+    }
 
   char number[16];
   snprintf(number,sizeof(number),m_index_format.c_str(),m_next_number);
@@ -141,6 +408,13 @@ void SavingCtrlObj::_prepare()
   filename += number;
   filename += m_suffix;
   m_cam.setFileName(filename);
+  m_cam.setImgpath(m_directory);
+
+  // the index is kept with the data, not on the ramdisk
+  if(m_frame_index_active)
+    m_frame_index.open(m_offload.isActive() ? m_offload.destination() :
+		       m_directory,m_prefix,m_suffix,m_next_number);
+  m_offload.watch(m_directory,m_prefix,m_suffix);
 #else
     THROW_CTL_ERROR(NotSupported) << "Lima is not compiled with the cbf "
                                      "saving option, not managed";  
@@ -0,0 +1,232 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <string.h>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "Exceptions.h"
+#include "PilatusSparse.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+/*******************************************************************
+ * \brief hit pixels scan
+ *******************************************************************/
+static void _scan_scalar(const int* data,long first,long nb_pixels,
+			 std::vector<int>& indices,std::vector<int>& counts)
+{
+  for(long i = first;i < nb_pixels;++i)
+    if(data[i] > 0)
+      {
+	indices.push_back(int(i));
+	counts.push_back(data[i]);
+      }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void _scan_avx2(const int* data,long first,long nb_pixels,
+		       std::vector<int>& indices,std::vector<int>& counts)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  long i = first;
+  // 32 pixels per test, most of them are empty
+  for(;i + 32 <= nb_pixels;i += 32)
+    {
+      __m256i a = _mm256_loadu_si256((const __m256i*)(data + i));
+      __m256i b = _mm256_loadu_si256((const __m256i*)(data + i + 8));
+      __m256i c = _mm256_loadu_si256((const __m256i*)(data + i + 16));
+      __m256i d = _mm256_loadu_si256((const __m256i*)(data + i + 24));
+      __m256i any = _mm256_max_epi32(_mm256_max_epi32(a,b),
+				     _mm256_max_epi32(c,d));
+      if(!_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(any,zero))))
+	continue;
+
+      for(int j = 0;j < 32;j += 8)
+	{
+	  __m256i value = _mm256_loadu_si256((const __m256i*)(data + i + j));
+	  unsigned mask =
+	    _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(value,zero)));
+	  while(mask)
+	    {
+	      int lane = __builtin_ctz(mask);
+	      mask &= mask - 1;
+	      indices.push_back(int(i + j + lane));
+	      counts.push_back(data[i + j + lane]);
+	    }
+	}
+    }
+  _scan_scalar(data,i,nb_pixels,indices,counts);
+}
+
+typedef void (*_scan_func)(const int*,long,long,
+			   std::vector<int>&,std::vector<int>&);
+static _scan_func _get_scan()
+{
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return _scan_avx2;
+  return _scan_scalar;
+}
+static const _scan_func _scan = _get_scan();
+#else
+#define _scan _scan_scalar
+#endif
+
+/*******************************************************************
+ * \brief SparseFrame
+ *******************************************************************/
+void SparseFrame::encode(int nb,const Size& frame_size,const int* data)
+{
+  frame_nb = nb;
+  size = frame_size;
+  indices.clear();
+  counts.clear();
+  _scan(data,0,long(size.getWidth()) * size.getHeight(),indices,counts);
+}
+//-----------------------------------------------------
+// dst must hold size.getWidth() * size.getHeight() pixels
+//-----------------------------------------------------
+void SparseFrame::decode(int* dst) const
+{
+  memset(dst,0,sizeof(int) * size.getWidth() * size.getHeight());
+  for(size_t i = 0;i < indices.size();++i)
+    dst[indices[i]] = counts[i];
+}
+
+void SparseFrame::swap(SparseFrame& other)
+{
+  std::swap(frame_nb,other.frame_nb);
+  std::swap(size,other.size);
+  indices.swap(other.indices);
+  counts.swap(other.counts);
+}
+
+/*******************************************************************
+ * \brief SparseFrames
+ *******************************************************************/
+SparseFrames::SparseFrames() :
+  m_active(false),
+  m_fifo_size(DEFAULT_FIFO_SIZE),
+  m_read_index(0),
+  m_nb_available(0),
+  m_nb_lost(0)
+{
+  DEB_CONSTRUCTOR();
+}
+
+SparseFrames::~SparseFrames()
+{
+  DEB_DESTRUCTOR();
+}
+
+void SparseFrames::setActive(bool flag)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(flag);
+  m_active = flag;
+}
+
+void SparseFrames::setFifoSize(int nb_frames)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(nb_frames);
+  if(nb_frames <= 0)
+    THROW_HW_ERROR(InvalidValue) << "Invalid fifo size: " << DEB_VAR1(nb_frames);
+
+  AutoMutex aLock(m_cond.mutex());
+  m_fifo_size = nb_frames;
+  m_fifo.clear();
+  m_nb_available = 0;
+}
+//-----------------------------------------------------
+// empty the fifo, frames of previous acquisition are lost
+//-----------------------------------------------------
+void SparseFrames::prepare()
+{
+  DEB_MEMBER_FUNCT();
+  AutoMutex aLock(m_cond.mutex());
+  m_fifo.resize(m_fifo_size);
+  m_read_index = 0;
+  m_nb_available = 0;
+  m_nb_lost = 0;
+}
+//-----------------------------------------------------
+// only called by the ingest, the fifo is never blocking
+//-----------------------------------------------------
+void SparseFrames::encode(int frame_nb,const Size& size,const int* data)
+{
+  m_scratch.encode(frame_nb,size,data);
+
+  AutoMutex aLock(m_cond.mutex());
+  if(m_fifo.empty())
+    return;			// fifo resized since prepare
+
+  if(m_nb_available == m_fifo_size)
+    {
+      m_read_index = (m_read_index + 1) % m_fifo_size;
+      --m_nb_available;
+      ++m_nb_lost;
+    }
+  int write_index = (m_read_index + m_nb_available) % m_fifo_size;
+  m_fifo[write_index].swap(m_scratch);
+  ++m_nb_available;
+  m_cond.broadcast();
+}
+//-----------------------------------------------------
+// pop available frames, wait up to timeout for the first one
+// (< 0 is forever). Vectors of frames are given back to the fifo.
+//-----------------------------------------------------
+int SparseFrames::readFrames(std::vector<SparseFrame>& frames,
+			     int max_nb_frames,double timeout)
+{
+  DEB_MEMBER_FUNCT();
+
+  AutoMutex aLock(m_cond.mutex());
+  if(!m_nb_available && timeout != 0.)
+    m_cond.wait(timeout);
+
+  int nb_frames = m_nb_available;
+  if(max_nb_frames >= 0 && nb_frames > max_nb_frames)
+    nb_frames = max_nb_frames;
+
+  frames.resize(nb_frames);
+  for(int i = 0;i < nb_frames;++i)
+    {
+      SparseFrame& slot = m_fifo[m_read_index];
+      frames[i].swap(slot);
+      slot.frame_nb = -1;
+      m_read_index = (m_read_index + 1) % m_fifo_size;
+    }
+  m_nb_available -= nb_frames;
+
+  DEB_RETURN() << DEB_VAR1(nb_frames);
+  return nb_frames;
+}
+
+int SparseFrames::nbLostFrames() const
+{
+  AutoMutex aLock(m_cond.mutex());
+  return m_nb_lost;
+}
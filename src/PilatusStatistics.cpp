@@ -0,0 +1,229 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "Exceptions.h"
+#include "PilatusStatistics.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+static const int COUNTER_MAX = (1 << 20) - 1;		// 20-bit counters
+
+/*******************************************************************
+ * \brief statistics kernels
+ *
+ * histogram bin is the exponent of the pixel value converted in
+ * float, i.e floor(log2(value)) + 1 (coarse for values > 2^24).
+ *******************************************************************/
+static inline int _histogram_bin(int value)
+{
+  if(value <= 0)
+    return 0;
+  float fvalue = float(value);
+  unsigned bits;
+  memcpy(&bits,&fvalue,sizeof(bits));
+  int bin = int(bits >> 23) - 126;
+  return bin < Statistics::NB_HISTOGRAM_BINS ? bin :
+    Statistics::NB_HISTOGRAM_BINS - 1;
+}
+
+static void _compute_scalar(const int* data,long nb_pixels,int threshold,
+			    Statistics::Result& result)
+{
+  for(long i = 0;i < nb_pixels;++i)
+    {
+      int value = data[i];
+      if(value < 0)
+	continue;
+      result.sum += value;
+      if(value > result.max)
+	result.max = value;
+      if(value >= threshold)
+	++result.nb_saturated;
+      ++result.histogram[_histogram_bin(value)];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void _compute_avx2(const int* data,long nb_pixels,int threshold,
+			  Statistics::Result& result)
+{
+  const __m256i minus_one = _mm256_set1_epi32(-1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i below_threshold = _mm256_set1_epi32(threshold - 1);
+  const __m256i exponent_bias = _mm256_set1_epi32(126);
+  const __m256i last_bin = _mm256_set1_epi32(Statistics::NB_HISTOGRAM_BINS - 1);
+  __m256i sum_low = zero,sum_high = zero;
+  __m256i max = zero;
+  __m256i nb_saturated = zero;
+  int bins[8] __attribute__((aligned(32)));
+  long i = 0;
+  for(;i + 8 <= nb_pixels;i += 8)
+    {
+      __m256i value = _mm256_loadu_si256((const __m256i*)(data + i));
+      __m256i valid = _mm256_cmpgt_epi32(value,minus_one);
+      value = _mm256_and_si256(value,valid);
+
+      sum_low = _mm256_add_epi64(sum_low,
+				 _mm256_cvtepu32_epi64(_mm256_castsi256_si128(value)));
+      sum_high = _mm256_add_epi64(sum_high,
+				  _mm256_cvtepu32_epi64(_mm256_extracti128_si256(value,1)));
+      max = _mm256_max_epi32(max,value);
+      // compare mask is -1, so subtracting it counts
+      nb_saturated = _mm256_sub_epi32(nb_saturated,
+				      _mm256_cmpgt_epi32(value,below_threshold));
+
+      __m256i exponent = _mm256_srli_epi32(_mm256_castps_si256(_mm256_cvtepi32_ps(value)),23);
+      __m256i bin = _mm256_max_epi32(_mm256_sub_epi32(exponent,exponent_bias),zero);
+      _mm256_store_si256((__m256i*)bins,_mm256_min_epi32(bin,last_bin));
+      int valid_mask = _mm256_movemask_ps(_mm256_castsi256_ps(valid));
+      for(int lane = 0;lane < 8;++lane)
+	if(valid_mask & (1 << lane))
+	  ++result.histogram[bins[lane]];
+    }
+
+  long long sums[8] __attribute__((aligned(32)));
+  _mm256_store_si256((__m256i*)sums,sum_low);
+  _mm256_store_si256((__m256i*)(sums + 4),sum_high);
+  int maxs[8] __attribute__((aligned(32)));
+  _mm256_store_si256((__m256i*)maxs,max);
+  int saturated[8] __attribute__((aligned(32)));
+  _mm256_store_si256((__m256i*)saturated,nb_saturated);
+  for(int lane = 0;lane < 8;++lane)
+    {
+      result.sum += sums[lane];
+      if(maxs[lane] > result.max)
+	result.max = maxs[lane];
+      result.nb_saturated += saturated[lane];
+    }
+  _compute_scalar(data + i,nb_pixels - i,threshold,result);
+}
+
+typedef void (*_compute_func)(const int*,long,int,Statistics::Result&);
+static _compute_func _get_compute()
+{
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return _compute_avx2;
+  return _compute_scalar;
+}
+static const _compute_func _compute = _get_compute();
+#else
+#define _compute _compute_scalar
+#endif
+
+/*******************************************************************
+ * \brief Statistics
+ *******************************************************************/
+Statistics::Statistics(int ring_size) :
+  m_active(false),
+  m_saturation_threshold(COUNTER_MAX),
+  m_ring(ring_size),
+  m_last_frame_nb(-1)
+{
+  DEB_CONSTRUCTOR();
+  reset();
+}
+
+Statistics::~Statistics()
+{
+  DEB_DESTRUCTOR();
+}
+
+void Statistics::setActive(bool flag)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(flag);
+  m_active = flag;
+}
+//-----------------------------------------------------
+// pixels >= threshold are counted as saturated
+//-----------------------------------------------------
+void Statistics::setSaturationThreshold(int threshold)
+{
+  DEB_MEMBER_FUNCT();
+  DEB_PARAM() << DEB_VAR1(threshold);
+  if(threshold <= 0)
+    THROW_HW_ERROR(InvalidValue) << "Invalid saturation threshold: "
+				 << DEB_VAR1(threshold);
+  m_saturation_threshold = threshold;
+}
+//-----------------------------------------------------
+// forget previous acquisition frames
+//-----------------------------------------------------
+void Statistics::reset()
+{
+  for(std::vector<Slot>::iterator slot = m_ring.begin();
+      slot != m_ring.end();++slot)
+    {
+      ++slot->sequence;
+      __sync_synchronize();
+      slot->result.frame_nb = -1;
+      __sync_synchronize();
+      ++slot->sequence;
+    }
+  m_last_frame_nb = -1;
+}
+//-----------------------------------------------------
+// only called by the ingest
+//-----------------------------------------------------
+void Statistics::compute(int frame_nb,const int* data,long nb_pixels)
+{
+  Result result;
+  memset(&result,0,sizeof(result));
+  result.frame_nb = frame_nb;
+  _compute(data,nb_pixels,m_saturation_threshold,result);
+
+  Slot& slot = m_ring[frame_nb % m_ring.size()];
+  ++slot.sequence;
+  __sync_synchronize();
+  slot.result = result;
+  __sync_synchronize();
+  ++slot.sequence;
+  m_last_frame_nb = frame_nb;
+}
+//-----------------------------------------------------
+// return false if the frame is not (or no more) in the ring
+//-----------------------------------------------------
+bool Statistics::get(int frame_nb,Result& result) const
+{
+  if(frame_nb < 0)
+    return false;
+
+  const Slot& slot = m_ring[frame_nb % m_ring.size()];
+  unsigned sequence = slot.sequence;
+  __sync_synchronize();
+  if(sequence & 1)
+    return false;		// being written, so it's a newer frame
+  result = slot.result;
+  __sync_synchronize();
+  return slot.sequence == sequence && result.frame_nb == frame_nb;
+}
+
+int Statistics::lastFrameNb() const
+{
+  return m_last_frame_nb;
+}
@@ -0,0 +1,116 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include <ctype.h>
+#include <string.h>
+#include "PilatusTiming.h"
+
+using namespace lima;
+using namespace lima::Pilatus;
+
+struct _ModelEntry
+{
+  const char*	model;
+  double	readout_time;
+  double	max_frame_rate;
+  double	min_exposure;
+  int		counter_bits;
+};
+
+/* Dectris datasheets values. Family entries ("PILATUS3", "PILATUS")
+ * are the defaults with the fastest rate of the family, the Pilatus2
+ * readout is the one the plugin always used (datasheet says 2.3 ms).
+ */
+static const _ModelEntry MODEL_TABLE[] = {
+  // model			readout	rate	min exp	bits
+  {"PILATUS3",			950e-6,	500.,	1e-6,	20},
+  {"PILATUS3 6M",		950e-6,	100.,	1e-6,	20},
+  {"PILATUS3 X 6M",		950e-6,	100.,	1e-6,	20},
+  {"PILATUS3 S 6M",		950e-6,	100.,	1e-6,	20},
+  {"PILATUS3 2M",		950e-6,	250.,	1e-6,	20},
+  {"PILATUS3 X 2M",		950e-6,	250.,	1e-6,	20},
+  {"PILATUS3 S 2M",		950e-6,	250.,	1e-6,	20},
+  {"PILATUS3 1M",		950e-6,	500.,	1e-6,	20},
+  {"PILATUS3 X 1M",		950e-6,	500.,	1e-6,	20},
+  {"PILATUS3 S 1M",		950e-6,	500.,	1e-6,	20},
+  {"PILATUS3 R",		950e-6,	20.,	1e-6,	20},
+  {"PILATUS",			3e-3,	300.,	1e-6,	20},
+  {"PILATUS 6M-F",		3e-3,	25.,	1e-6,	20},
+  {"PILATUS 6M",		3e-3,	12.,	1e-6,	20},
+  {"PILATUS 2M",		3e-3,	30.,	1e-6,	20},
+  {"PILATUS 1M",		3e-3,	30.,	1e-6,	20},
+  {"PILATUS 300K",		3e-3,	200.,	1e-6,	20},
+  {"PILATUS 100K",		3e-3,	300.,	1e-6,	20},
+};
+
+static const int NB_MODELS = sizeof(MODEL_TABLE) / sizeof(MODEL_TABLE[0]);
+
+ModelTiming::ModelTiming() :
+  readout_time(3e-3),
+  max_frame_rate(0.),
+  min_exposure(1e-6),
+  counter_bits(20)
+{
+}
+
+ModelTiming ModelTiming::find(const std::string& camera_name)
+{
+  const _ModelEntry* best = NULL;
+  size_t best_length = 0;
+  for(int i = 0;i < NB_MODELS;++i)
+    {
+      const _ModelEntry& entry = MODEL_TABLE[i];
+      size_t length = strlen(entry.model);
+      if(camera_name.compare(0,length,entry.model))
+	continue;
+      // "PILATUS 1M" must not match "PILATUS 10M"
+      if(camera_name.size() > length && isalnum(camera_name[length]) &&
+	 isalnum(entry.model[length - 1]))
+	continue;
+      if(!best || length > best_length)
+	{
+	  best = &entry;
+	  best_length = length;
+	}
+    }
+
+  ModelTiming timing;
+  if(best)
+    {
+      timing.model = best->model;
+      timing.readout_time = best->readout_time;
+      timing.max_frame_rate = best->max_frame_rate;
+      timing.min_exposure = best->min_exposure;
+      timing.counter_bits = best->counter_bits;
+    }
+  return timing;
+}
+//-----------------------------------------------------
+// fastest legal exposure period for exposure
+//-----------------------------------------------------
+double ModelTiming::minPeriod(double exposure) const
+{
+  double period = exposure + readout_time;
+  if(max_frame_rate <= 0.)
+    return period;		// unknown model
+  double frame_rate_period = 1. / max_frame_rate;
+  return period > frame_rate_period ? period : frame_rate_period;
+}